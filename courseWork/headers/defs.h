@@ -5,9 +5,99 @@
 #ifndef DEFS_H   // Include guard
 #define DEFS_H
 
+#include <stdint.h>
+
+// Kernel table sizes, set at build time (RTOS_MAX_TASK, RTOS_MAX_RES and
+// RTOS_MAX_EVENT in CMake). Only setup and shutdown walk whole tables.
+#ifndef MAX_TASK
 #define MAX_TASK 32
+#endif
+#ifndef MAX_RES
 #define MAX_RES   16
+#endif
+#ifndef MAX_EVENT
 #define MAX_EVENT 16
+#endif
+#ifndef MAX_QUEUE
+#define MAX_QUEUE 8
+#endif
+
+// Bytes shared by the slots of all message queues of a kernel
+#ifndef QUEUE_STORAGE_SIZE
+#define QUEUE_STORAGE_SIZE 4096
+#endif
+
+// Counters and alarms (OSEK) of a kernel, counter 0 is the system tick
+#ifndef MAX_COUNTER
+#define MAX_COUNTER 4
+#endif
+#ifndef MAX_ALARM
+#define MAX_ALARM 64
+#endif
+#define SYSTEM_COUNTER 0
+
+// Buffer pools of a kernel and the bytes shared by their blocks
+#ifndef MAX_POOL
+#define MAX_POOL 4
+#endif
+#ifndef BUFFER_STORAGE_SIZE
+#define BUFFER_STORAGE_SIZE (16 * 1024)
+#endif
+
+// Tasks (by name) with response time statistics, and the log2 buckets
+// of each histogram: bucket 0 counts 0 ticks, bucket b counts 2^(b-1)
+// up to 2^b - 1 ticks, the last bucket everything above
+#ifndef MAX_TASK_STATS
+#define MAX_TASK_STATS 32
+#endif
+#define STATS_BUCKETS 16
+#define STATS_NAME_SLOTS (2 * MAX_TASK_STATS)  // Name pointers already looked up
+
+// Critical sections declared for the blocking terms of the
+// schedulability analysis, one per task and resource
+#ifndef MAX_RESOURCE_USE
+#define MAX_RESOURCE_USE 64
+#endif
+
+// Number of priority levels, valid priorities are 0 .. MAX_PRIORITY - 1
+// (a larger value is a higher priority)
+#define MAX_PRIORITY 32
+
+// Task control blocks are allocated TASK_CHUNK_SIZE at a time, up to MAX_TASK
+#ifndef TASK_CHUNK_SIZE
+#define TASK_CHUNK_SIZE 32
+#endif
+#define MAX_TASK_CHUNKS ((MAX_TASK + TASK_CHUNK_SIZE - 1) / TASK_CHUNK_SIZE)
+
+// Task handles given to applications: slot index in the low bits, the
+// generation of the slot above it. A handle kept after its task ended
+// no longer matches the generation and is rejected.
+#define TASK_INDEX_BITS 20
+#define TASK_GENERATION_MASK 0x7FF
+#define TASK_HANDLE(task, generation) (((generation) << TASK_INDEX_BITS) | (task))
+
+// Timers: one wakeup and one release timer per task, the alarm timers
+// follow the ones of all task slots
+#define WAKEUP_TIMER(task) (2 * (task))
+#define RELEASE_TIMER(task) (2 * (task) + 1)
+#define ALARM_TIMER_BASE (2 * MAX_TASK)
+#define ALARM_TIMER(alarm) (ALARM_TIMER_BASE + (alarm))
+#define IS_ALARM_TIMER(timer) ((timer) >= ALARM_TIMER_BASE)
+
+// Timer wheel geometry, covers 2^(TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS) ticks
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// Stack of each task context
+#ifndef TASK_STACK_SIZE
+#define TASK_STACK_SIZE (64 * 1024)
+#endif
+
+// Idle ticks without any ready task before the system shuts down
+#ifndef IDLE_TICK_LIMIT
+#define IDLE_TICK_LIMIT 30
+#endif
 
 enum T_TaskState{
     TASK_RUNNING,
@@ -21,8 +111,31 @@ enum T_TaskState{
 #define INSERT_TO_TAIL 1
 #define INSERT_TO_HEAD 0
 
+// Scheduling policies. Under EDF the ready job with the earliest absolute
+// deadline runs, the task priority is its SRP preemption level.
+#define POLICY_PRIORITY 0
+#define POLICY_EDF 1
+
+// Resource protocols
+#define RESOURCE_CEILING 0      // Immediate priority ceiling
+#define RESOURCE_INHERIT 1      // Priority inheritance, the owner is boosted on contention
+
+// Alarm actions
+#define ALARM_ACTIVATE_TASK 0   // Activate a task
+#define ALARM_SET_EVENT 1       // Deliver events to a task
+#define ALARM_CALLBACK 2        // Call a function, the scheduler is locked meanwhile
+
+// Reactions to a missed deadline, each miss is counted and traced first
+#define DEADLINE_LOG 0          // Print it (scheduling trace level)
+#define DEADLINE_HOOK 1         // Call the hook given to SetDeadlineReaction()
+#define DEADLINE_ABORT 2        // End a job found late at its next release
+
 // Event status flags
 #define EVENT_CLEAR 0
 #define EVENT_SET 1
 
+// Task event masks (OSEK): one bit per event, a machine word per task
+typedef uintptr_t TEventMask;
+#define EVENT_MASK(event_id) ((TEventMask)1 << (event_id))
+
 #endif  // End of include guard
\ No newline at end of file
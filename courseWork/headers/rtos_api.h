@@ -2,6 +2,13 @@
 /*           rtos_api.h                 */
 /****************************************/
 
+#ifndef RTOS_API_H   // Include guard
+#define RTOS_API_H
+
+#include <stdio.h>
+
+#include "defs.h"
+
 // Task declaration macros
 #define DeclareTask(TaskID, priority) \
     TASK(TaskID); \
@@ -11,9 +18,12 @@
 #define DeclareResource(ResID, priority) \
     enum {ResID = priority}
 
-// Event declaration macro
-#define DeclareEvent(EventID) \
-    enum {EventID}
+// Event declaration macro, every event needs an id of its own: its slot
+// in the event table and its bit in a task event mask
+#define DeclareEvent(EventID, id) \
+    enum {EventID = id}; \
+    static_assert((id) >= 0 && (id) < MAX_EVENT && (id) < 8 * (int)sizeof(TEventMask), \
+                  "Event " #EventID " needs an id below MAX_EVENT and the bits of TEventMask")
 
 // Task definition macro
 #define TASK(TaskID) void TaskID(void)
@@ -32,19 +42,152 @@ void ShutdownOS(void);
 void IdleLoop(void);  // System idle loop
 
 // Resource management (simple semaphores)
-void GetResource(int priority, char* name);   // Acquire semaphore
-void ReleaseResource(int priority, char* name);  // Release semaphore
+int GetResource(int priority, char* name);    // Acquire semaphore, returns a handle
+void ReleaseResource(int handle);             // Release the last resource taken
+void ReleaseResource(int priority, char* name);  // Same, checked by priority and name
+int CreateResource(int priority, int protocol, char* name);  // Resource kept until shutdown
+int GetResource(int handle);                  // Take a created resource, may block
 
 // Event management
 void SetEvent(int event_id, char* name);      // Set event
 void ClearEvent(int event_id, char* name);    // Clear event
 void WaitEvent(int event_id, char* name);     // Wait for event
 
+// Task events (OSEK), masks are built with EVENT_MASK(event_id)
+void SetEvent(int task_id, TEventMask mask);  // Deliver events to a task
+int GetEvent(int task_id, TEventMask* mask);  // Events delivered to a task
+void ClearEvent(TEventMask mask);             // Clear events of the running task
+void WaitEvent(TEventMask mask);              // Wait for any event of the mask
+
+// Message queues, messages are copied in and out of preallocated slots
+int CreateQueue(int message_size, int length, char* name);  // Returns a queue id
+int SendMessage(int queue_id, const void* message);     // Blocks while the queue is full
+int ReceiveMessage(int queue_id, void* message);        // Blocks while the queue is empty
+int TrySendMessage(int queue_id, const void* message);  // -1 instead of blocking
+int TryReceiveMessage(int queue_id, void* message);     // -1 instead of blocking
+
+// Buffer pools, blocks are handed between tasks without copying
+typedef struct Type_buffer_stats
+{
+    int allocated;      // Successful AllocBuffer() calls
+    int freed;          // Blocks returned to the pool
+    int failed;         // AllocBuffer() calls on an empty pool
+    int in_use;         // Blocks out of the pool now
+    int peak;           // Most blocks out of the pool at once
+} TBufferStats;
+
+int CreateBufferPool(int block_size, int count, char* name);  // Returns a pool id
+void* AllocBuffer(int pool_id);               // NULL if the pool is empty
+int FreeBuffer(void* buffer);                 // Give a block back to its pool
+int SendBuffer(int task_id, void* buffer, TEventMask mask);  // Hand over a block, then SetEvent
+void* ReceiveBuffer(void);                    // Next block sent to the running task, NULL if none
+int GetBufferStats(int pool_id, TBufferStats* stats);
+
 // POSIX-like functions
 int CreateTask(TTaskCall entry, int priority, char* name);  // Create but don't activate
 int SuspendTask(int task_id);                 // Suspend a task
 int ResumeTask(int task_id);                  // Resume a suspended task
+int DeleteTask(int task_id);                  // End another task for good and free its slot
+int GetTaskID(void);                          // Handle of the running task
+
+// Counters and alarms (OSEK). Counter SYSTEM_COUNTER counts the system
+// ticks, other counters advance with IncrementCounter().
+typedef struct Type_alarm_action
+{
+    int type;                   // ALARM_ACTIVATE_TASK, ALARM_SET_EVENT or ALARM_CALLBACK
+    TTaskCall* entry;           // Task activated on expiry
+    int priority;
+    const char* name;
+    int task_id;                // Task the events are delivered to
+    TEventMask mask;
+    void (*callback)(void);     // Function called on expiry
+} TAlarmAction;
+
+#define AlarmActivateTask(TaskID) {ALARM_ACTIVATE_TASK, TaskID, TaskID##prior, #TaskID, -1, 0, NULL}
+#define AlarmSetEvent(task_id, mask) {ALARM_SET_EVENT, NULL, 0, NULL, task_id, mask, NULL}
+#define AlarmCallback(function) {ALARM_CALLBACK, NULL, 0, NULL, -1, 0, function}
+
+int CreateCounter(int max_value, char* name); // Returns a counter id
+int IncrementCounter(int counter_id);         // Advance a counter by one, runs due alarms
+int GetCounterValue(int counter_id, int* value);
+int CreateAlarm(int counter_id, TAlarmAction action, char* name);  // Returns an alarm id
+int SetRelAlarm(int alarm_id, int increment, int cycle);  // Expire increment ticks from now
+int SetAbsAlarm(int alarm_id, int start, int cycle);      // Expire when the counter reaches start
+int CancelAlarm(int alarm_id);
+int GetAlarm(int alarm_id, int* ticks);       // Ticks left until the alarm expires
 
 // RMA specific functions
 void SetTaskPeriod(int task_id, int period);  // Set the period for a task
-void SetTaskDeadline(int task_id, int deadline);  // Set the deadline for a task
\ No newline at end of file
+void SetTaskDeadline(int task_id, int deadline);  // Set the deadline for a task
+
+// A job misses its deadline when it has not completed deadline ticks
+// after its release. It is found at its completion or at the next
+// release of its task, whichever comes first.
+typedef void TDeadlineHook(int task_id, int lateness);
+void SetDeadlineReaction(int reaction, TDeadlineHook* hook);  // DEADLINE_LOG, DEADLINE_HOOK or DEADLINE_ABORT
+
+// POLICY_PRIORITY (default) or POLICY_EDF. Under EDF the priority of a
+// task is its preemption level: a job only starts while its level is
+// above the ceilings of all held resources (Stack Resource Policy).
+int SetSchedulingPolicy(int policy);
+
+// Schedulability of the periodic tasks that declared a WCET. Nothing is
+// allocated and it runs in microseconds, so it can decide whether a new
+// task is admitted: one that fails is withdrawn with DeleteTask(id).
+// The bounds are sufficient tests for deadlines equal to the periods,
+// the response time analysis is exact for fixed priorities and includes
+// the blocking by lower priority tasks in the critical sections
+// declared with SetResourceUse().
+typedef struct Type_schedulability
+{
+    int tasks;                  // Periodic tasks with a WCET
+    double utilization;
+    double liu_layland_bound;   // n (2^(1/n) - 1)
+    int liu_layland;            // 1 if the utilization is within the bound
+    double hyperbolic;          // Product of (U_i + 1)
+    int hyperbolic_ok;          // 1 if the product is at most 2
+    int response_time;          // 1 if every task meets its deadline by the analysis
+    int failed_task;            // Handle of the highest priority task that does not, -1 if none
+    int edf;                    // 1 if the set is schedulable under POLICY_EDF with SRP
+} TSchedulability;
+
+void SetTaskWcet(int task_id, int wcet);      // Worst case execution time in ticks
+int SetResourceUse(int task_id, int resource, int ticks);  // Longest critical section on a created resource
+int AnalyzeSchedulability(TSchedulability* result);
+int GetResponseBound(int task_id);            // Response of the last analysis, -1 if late or unknown
+
+// Job timing of a task, all activations under the same name count as one
+// task. Times are in ticks: the response runs from the release to the
+// completion, the start latency from the release to the first dispatch.
+typedef struct Type_task_stats
+{
+    int jobs;                   // Completed jobs
+    int last_release;           // Times of the last completed job
+    int last_start;
+    int last_completion;
+    int min_response;
+    int max_response;
+    long long total_response;
+    int max_latency;
+    int misses;                 // Jobs that missed their deadline
+    int max_lateness;           // Ticks past the deadline, worst job
+    int response[STATS_BUCKETS];    // Histograms, see STATS_BUCKETS
+    int latency[STATS_BUCKETS];
+} TTaskStats;
+
+// The histograms of all tasks are printed whatever the trace level, by
+// ShutdownOS() to stdout unless SetStatsOutput() picked another file or
+// NULL for none
+int GetTaskStats(const char* name, TTaskStats* stats);
+void DumpTaskStats(FILE* file);
+void SetStatsOutput(FILE* file);
+
+// Tracing
+int TraceDump(const char* path);  // Write the binary event trace to a file
+// Kernel instances (each thread runs the kernel it selected)
+typedef struct Type_kernel TKernel;
+TKernel* CreateKernel(void);                  // Allocate an independent system
+void DeleteKernel(TKernel* kernel);           // Free a system that is not running
+void SelectKernel(TKernel* kernel);           // Route this thread's calls, NULL = default
+
+#endif  // End of include guard
@@ -0,0 +1,149 @@
+/****************************************/
+/*           rtos_config.h              */
+/****************************************/
+
+// Static system configuration, the counterpart of an OSEK OIL file. The
+// tables are constexpr, so they are checked by the compiler and end up in
+// read-only data. Resource ceilings are computed from the resources each
+// task declares it uses. The kernel tables themselves are writable state
+// of every kernel instance, StartOS(&System) fills them from the
+// description with the same calls a dynamic system makes.
+//
+//     enum {ResBus, ResLog};               // Resource ids are table positions
+//
+//     constexpr TResourceConfig Resources[] = {
+//         ConfigResource(ResBus, RESOURCE_CEILING),
+//         ConfigResource(ResLog, RESOURCE_INHERIT)
+//     };
+//     constexpr TEventConfig Events[] = {ConfigEvent(Event1)};
+//     constexpr TTaskConfig Tasks[] = {
+//         //         task     prio period deadline autostart  uses
+//         ConfigTask(Sampler, 3,   5,     5,       AUTOSTART, USES(ResBus)),
+//         ConfigTask(Logger,  1,   0,     0,       0,         USES(ResBus) | USES(ResLog))
+//     };
+//     DeclareSystem(System, Tasks, Resources, Events);
+//
+//     StartOS(&System);
+
+#ifndef RTOS_CONFIG_H   // Include guard
+#define RTOS_CONFIG_H
+
+#include <stdint.h>
+
+#include "rtos_api.h"
+
+#define AUTOSTART 1
+#define USES(ResID) ((uint32_t)1 << (ResID))
+
+typedef struct Type_task_config
+{
+    TTaskCall* entry;
+    const char* name;
+    int priority;
+    int period;         // 0 for a task that is not released periodically
+    int deadline;       // 0 for no deadline
+    int autostart;      // Ready when the system starts
+    uint32_t resources; // USES() bits of the resources the task takes
+
+} TTaskConfig;
+
+typedef struct Type_resource_config
+{
+    const char* name;
+    int protocol;
+
+} TResourceConfig;
+
+typedef struct Type_event_config
+{
+    const char* name;
+
+} TEventConfig;
+
+typedef struct Type_system_config
+{
+    const TTaskConfig* tasks;
+    int task_count;
+    const TResourceConfig* resources;
+    const int* ceilings;
+    int resource_count;
+    const TEventConfig* events;
+    int event_count;
+
+} TSystemConfig;
+
+#define ConfigTask(TaskID, priority, period, deadline, autostart, uses) \
+    {TaskID, #TaskID, priority, period, deadline, autostart, uses}
+
+#define ConfigResource(ResID, protocol) \
+    {#ResID, protocol}
+
+#define ConfigEvent(EventID) \
+    {#EventID}
+
+// Ceiling of every resource: the highest priority of the tasks using it
+template <int Count>
+struct Type_ceilings
+{
+    int value[Count];
+};
+
+template <int Resources, int Tasks>
+constexpr Type_ceilings<Resources> ComputeCeilings(const TTaskConfig (&tasks)[Tasks])
+{
+    Type_ceilings<Resources> ceilings{};
+    int r, t;
+
+    for (r = 0; r < Resources; r++)
+    {
+        ceilings.value[r] = 0;
+
+        for (t = 0; t < Tasks; t++)
+        {
+            if ((tasks[t].resources & USES(r)) && tasks[t].priority > ceilings.value[r])
+                ceilings.value[r] = tasks[t].priority;
+        }
+    }
+
+    return ceilings;
+}
+
+template <int Tasks>
+constexpr bool TasksValid(const TTaskConfig (&tasks)[Tasks], int resources)
+{
+    int t;
+
+    for (t = 0; t < Tasks; t++)
+    {
+        // The entry is not compared with nullptr: the address of a function
+        // is no constant expression under the sanitizers, CreateTask()
+        // rejects a missing one
+        if (tasks[t].priority < 0 || tasks[t].priority >= MAX_PRIORITY ||
+            tasks[t].period < 0 || tasks[t].deadline < 0 ||
+            (resources < 32 && (tasks[t].resources >> resources) != 0))
+            return false;
+    }
+
+    return true;
+}
+
+#define CONFIG_COUNT(table) ((int)(sizeof(table) / sizeof((table)[0])))
+
+// Checks the tables and builds the system description at compile time
+#define DeclareSystem(SystemID, tasks, resources, events) \
+    static_assert(CONFIG_COUNT(tasks) <= MAX_TASK, "Too many tasks"); \
+    static_assert(CONFIG_COUNT(resources) <= MAX_RES && CONFIG_COUNT(resources) <= 32, "Too many resources"); \
+    static_assert(CONFIG_COUNT(events) <= MAX_EVENT, "Too many events"); \
+    static_assert(TasksValid(tasks, CONFIG_COUNT(resources)), "Invalid task in " #tasks); \
+    constexpr Type_ceilings<CONFIG_COUNT(resources)> SystemID##Ceilings = \
+        ComputeCeilings<CONFIG_COUNT(resources)>(tasks); \
+    constexpr TSystemConfig SystemID = { \
+        tasks, CONFIG_COUNT(tasks), \
+        resources, SystemID##Ceilings.value, CONFIG_COUNT(resources), \
+        events, CONFIG_COUNT(events)}
+
+// Start the kernel with every object of the configuration in place,
+// resource handles and event ids are the positions in their tables
+int StartOS(const TSystemConfig* config);
+
+#endif  // End of include guard
@@ -0,0 +1,121 @@
+/****************************************/
+/*           rtos_coro.h                */
+/****************************************/
+
+// Coroutine tasks: stackless tasks written as C++20 coroutines. They run
+// on the OS context and give up the processor only at a co_await, so a
+// task needs no stack of its own while it waits.
+//
+//     COTASK(Consumer)
+//     {
+//         co_await CoWaitEvent(Event1, name);
+//         co_await CoDelayTask(5);
+//         co_return;              // Ends the task, TerminateTask() is not used
+//     }
+
+#ifndef RTOS_CORO_H   // Include guard
+#define RTOS_CORO_H
+
+#include <coroutine>
+#include <exception>
+
+#include "rtos_api.h"
+
+typedef struct Type_cotask
+{
+    struct promise_type
+    {
+        Type_cotask get_return_object()
+        {
+            return Type_cotask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        // The kernel starts the body on the first dispatch
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        // The kernel destroys the frame once the body has finished
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> frame;
+
+} TCoTask;
+
+// Coroutine task definition macro
+#define COTASK(TaskID) TCoTask TaskID(void)
+
+// Coroutine task declaration macro
+#define DeclareCoTask(TaskID, priority) \
+    COTASK(TaskID); \
+    enum {TaskID##prior = priority}
+
+// Coroutine task function type
+typedef TCoTask TCoTaskCall(void);
+
+void ActivateCoTask(TCoTaskCall entry, int priority, char* name);
+
+// Non-zero when the calling coroutine task has to suspend: it waits now,
+// or a task of higher priority became ready
+int CoTaskYields(void);
+
+// Awaited after a kernel call, suspends the coroutine if that call
+// blocked it or made another task run
+typedef struct Type_coreschedule
+{
+    bool await_ready() { return !CoTaskYields(); }
+    void await_suspend(std::coroutine_handle<>) {}
+    void await_resume() {}
+
+} TCoReschedule;
+
+inline TCoReschedule CoWaitEvent(int event_id, char* name)
+{
+    WaitEvent(event_id, name);
+    return TCoReschedule{};
+}
+
+inline TCoReschedule CoWaitEvent(TEventMask mask)
+{
+    WaitEvent(mask);
+    return TCoReschedule{};
+}
+
+inline TCoReschedule CoDelayTask(int ticks)
+{
+    DelayTask(ticks);
+    return TCoReschedule{};
+}
+
+inline TCoReschedule CoGetResource(int priority, char* name)
+{
+    GetResource(priority, name);
+    return TCoReschedule{};
+}
+
+inline TCoReschedule CoGetResource(int handle)
+{
+    GetResource(handle);
+    return TCoReschedule{};
+}
+
+inline TCoReschedule CoReleaseResource(int handle)
+{
+    ReleaseResource(handle);
+    return TCoReschedule{};
+}
+
+inline TCoReschedule CoReleaseResource(int priority, char* name)
+{
+    ReleaseResource(priority, name);
+    return TCoReschedule{};
+}
+
+// Lets a higher priority task run that became ready since the last co_await
+inline TCoReschedule CoSchedule(void)
+{
+    return TCoReschedule{};
+}
+
+#endif  // End of include guard
@@ -2,44 +2,499 @@
 /*               sys.h                   /          
 /****************************************/
 
+#ifndef SYS_H   // Include guard
+#define SYS_H
+
+#include <stdint.h>
+
 #include "defs.h"
+#include "trace.h"
+#include "rtos_api.h"
 
-typedef struct Type_Task
+typedef struct Type_timer
 {
 	int ref;
+	int prev;
+	int slot;
+	int expire;
+
+} TTimer;
+
+// Cold part of a task slot, the fields the scheduler reads on every
+// switch are kept per field in TTaskChunk
+typedef struct Type_Task
+{
 	int priority;
-	int ceiling_priority;
-    int state;
     int waiting_event;
+    TEventMask events_set;      // Events delivered to the task
+    TEventMask events_waited;   // Events the task blocks on, 0 if none
+    int resources;              // Last resource taken (top of the stack), -1 if none
+    int blocked_on;             // Resource the task waits for, -1 if none
+    int waiting_queue;          // Message queue the task waits on, -1 if none
+    void* message;              // Message of a blocked send or receive, NULL once done
+    int inbox_head;             // Buffers sent to the task, offsets in BufferStorage
+    int inbox_tail;
+    int generation;             // Counts the times the slot was freed
 	void (*entry)(void);
+	void* coroutine;    // Frame of a coroutine task, NULL for a stackful task
 	char* name;
 
+    // RMA specific variables
+    int period;
+    int deadline;
+    int last_run;
+    int start;          // Tick the job first ran, -1 until it runs
+    int stats;          // Entry in TaskStats, -1 if there was no room
+    int job;            // Handle of the last job released from this task, -1 if none
+    char late;          // The current job missed its deadline
+    int wcet;           // Declared worst case execution time, 0 if unknown
+    int response_bound; // Worst case response of the last analysis, -1 if none
+
+    // Context, allocated the first time the slot runs and kept for reuse.
+    // fresh marks a context that starts from the entry point.
+    void* context;
+    char fresh;
+    char in_heap;       // In the EDF heap, ref is the position there
+
 } TTask;
 
+// TASK_CHUNK_SIZE task slots. The hot fields are stored one array per
+// field (structure of arrays) in the narrowest type that holds them: the
+// scheduler state of a chunk is 320 bytes instead of one control block
+// per task, and loops over the slots run on packed bytes.
+typedef struct Type_task_chunk
+{
+    int32_t ref[TASK_CHUNK_SIZE];               // Link of the queue the task is in
+    int32_t prev[TASK_CHUNK_SIZE];              // Back link in its ready level, see TASK_UNLINKED
+    int8_t ceiling_priority[TASK_CHUNK_SIZE];   // Priority the task runs at
+    uint8_t state[TASK_CHUNK_SIZE];             // T_TaskState
+    TTimer timers[2 * TASK_CHUNK_SIZE];         // Wakeup and release timer of each slot
+    TTask tasks[TASK_CHUNK_SIZE];
+
+} TTaskChunk;
+
+// prev of a task in no ready level, the head of a level has -1
+#define TASK_UNLINKED (-2)
+
+// Task slots in chunks, slot task is in chunks[task / size] at task % size
+typedef struct Type_task_table
+{
+    TTaskChunk* chunks[MAX_TASK_CHUNKS];
+
+    TTask& operator[](int task)
+    {
+        return chunks[task / TASK_CHUNK_SIZE]->tasks[task % TASK_CHUNK_SIZE];
+    }
+
+    int32_t& ref(int task)
+    {
+        return chunks[task / TASK_CHUNK_SIZE]->ref[task % TASK_CHUNK_SIZE];
+    }
+
+    int32_t& prev(int task)
+    {
+        return chunks[task / TASK_CHUNK_SIZE]->prev[task % TASK_CHUNK_SIZE];
+    }
+
+    int8_t& ceiling(int task)
+    {
+        return chunks[task / TASK_CHUNK_SIZE]->ceiling_priority[task % TASK_CHUNK_SIZE];
+    }
+
+    uint8_t& state(int task)
+    {
+        return chunks[task / TASK_CHUNK_SIZE]->state[task % TASK_CHUNK_SIZE];
+    }
+
+    TTimer& timer(int timer)
+    {
+        return chunks[timer / (2 * TASK_CHUNK_SIZE)]->timers[timer % (2 * TASK_CHUNK_SIZE)];
+    }
+
+} TTaskTable;
+
+// Coroutine tasks run on the OS context between two co_await points
+#define IS_COTASK(task) ((task) != -1 && TaskQueue[task].coroutine != NULL)
+
+// A held resource is on the LIFO stack of its task: below links to the
+// resource taken before it, saved_ceiling is the ceiling to restore.
+// A held resource with a ceiling is also on the stack of the system
+// (system_below, saved_system_ceiling), see SystemCeiling.
+// Created resources keep their slot, tasks blocked on one are linked
+// through their task ref starting at waiting.
 typedef struct Type_resource
 {
 	int task;
 	int priority;
+	int below;
+	int saved_ceiling;
+	int system_below;
+	int saved_system_ceiling;
+	int protocol;
+	int persistent;
+	int waiting;
 	char* name;
 
 } TResource;
 
+// Longest critical section of a task on a created resource, the task is
+// kept by handle so the entry of an ended task is ignored
+typedef struct Type_resource_use
+{
+    int task;
+    int resource;
+    int ticks;
+
+} TResourceUse;
+
+// Tasks waiting for the event are linked through their ref (a waiting
+// task is in no ready queue), in the order they started to wait
 typedef struct Type_event{
     int status;
+    int waiting_head;
+    int waiting_tail;
     char* name;
 } TEvent;
 
-extern TTask TaskQueue[MAX_TASK];
-extern TResource ResourceQueue[MAX_RES];
-extern TEvent EventQueue[MAX_EVENT];
+// Ring of length fixed-size messages in the kernel queue storage. Only
+// one side can wait at a time (senders on a full queue, receivers on an
+// empty one), both lists are linked through the task ref.
+typedef struct Type_queue
+{
+    int storage;        // Offset in QueueStorage
+    int message_size;
+    int length;
+    int head;
+    int count;
+    int send_head;
+    int send_tail;
+    int receive_head;
+    int receive_tail;
+    char* name;
+
+} TQueue;
+
+// Every block of a pool starts with this header, the caller gets the
+// bytes after it. next links free blocks and task inboxes.
+typedef struct Type_buffer_header
+{
+    int32_t pool;
+    int32_t next;
+    int32_t owner;      // Task slot that holds the block, -1 if free or outside of tasks
+    int32_t state;      // BUFFER_FREE, BUFFER_OWNED or BUFFER_SENT
+
+} TBufferHeader;
+
+#define BUFFER_FREE 0
+#define BUFFER_OWNED 1
+#define BUFFER_SENT 2
+
+// Blocks of one size in BufferStorage, counts kept for GetBufferStats()
+typedef struct Type_buffer_pool
+{
+    int storage;        // Offset of the first block
+    int block_size;     // Stride of the blocks, header included
+    int count;
+    int free;           // Offset of the first free block, -1 if none
+    int allocated;
+    int freed;
+    int failed;
+    int in_use;
+    int peak;
+    char* name;
+
+} TBufferPool;
+
+// Timer wheel, tick is the last tick whose timers were run, bit s of
+// map[level] is set while that slot is not empty
+typedef struct Type_timer_wheel
+{
+    int slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SIZE];
+    uint64_t map[TIMER_WHEEL_LEVELS];
+    int tick;
+
+} TTimerWheel;
+
+// Counter (OSEK), its value wraps to 0 after max_value. The wheel runs on
+// the ticks counted since StartOS(), the system counter is SystemTick.
+typedef struct Type_counter
+{
+    TTimerWheel wheel;
+    int max_value;
+    char* name;
+
+} TCounter;
+
+// Alarm on a counter, cycle is 0 for a one-shot alarm
+typedef struct Type_alarm
+{
+    TTimer timer;
+    int counter;
+    int cycle;
+    int active;
+    TAlarmAction action;
+    int stats;          // TaskStats entry of the activated task
+    char* name;
+
+} TAlarm;
+
+// Ready job in the EDF heap, jobs with the same deadline are served in
+// the order they became ready (sequence)
+typedef struct Type_edf_entry
+{
+    int deadline;       // Absolute, INT_MAX for a task without deadline
+    int sequence;
+    int task;
+
+} TEdfEntry;
+
+// Parameters of a task in the schedulability analysis
+typedef struct Type_analysis_task
+{
+    int task;
+    int priority;
+    int period;
+    int deadline;
+    int wcet;
+    int blocking;
+
+} TAnalysisTask;
+
+// Timing of the jobs of one task name, see GetTaskStats()
+typedef struct Type_stats_record
+{
+    const char* name;
+    TTaskStats stats;
+
+} TStatsRecord;
+
+// Name pointer that was already looked up, an open addressing table
+// keyed on the pointer so the same literal finds its record at once
+typedef struct Type_stats_name
+{
+    const char* name;
+    int record;
+
+} TStatsName;
+
+#ifdef _WIN32
+typedef void* TContext;         // Fiber
+#else
+#include <ucontext.h>
+typedef ucontext_t TContext;
+#endif
+
+static_assert(MAX_TASK <= (1 << TASK_INDEX_BITS), "Task handles hold slot indexes in TASK_INDEX_BITS");
+static_assert(MAX_PRIORITY <= INT8_MAX + 1, "Task ceilings are stored in int8_t");
+
+// State of one simulated system. Every API call works on CurrentKernel,
+// so each thread can run its own system.
+typedef struct Type_kernel
+{
+    // System queues, TaskCount task slots exist so far
+    TTaskTable TaskQueue;
+    int TaskCount;
+    TResource ResourceQueue[MAX_RES];
+    TResourceUse ResourceUse[MAX_RESOURCE_USE];
+    int ResourceUseCount;
+    TEvent EventQueue[MAX_EVENT];
+    TQueue MessageQueue[MAX_QUEUE];
+    char QueueStorage[QUEUE_STORAGE_SIZE];
+    TBufferPool BufferPool[MAX_POOL];
+    alignas(16) char BufferStorage[BUFFER_STORAGE_SIZE];
+
+    int RunningTask;
+    int FreeTask;
+    int FreeResource;
+    int FreeEvent;
+    int QueueCount;
+    int QueueStorageUsed;
+    int PoolCount;
+    int BufferStorageUsed;
 
-extern int RunningTask;
-extern int FreeTask;
-extern int FreeResource;
-extern int FreeEvent;
+    // Task whose context is executing, -1 for the OS context
+    int ActiveContext;
+    // Dispatch() does nothing while this is not zero (timer processing)
+    int SchedulerLock;
+    int OsShutdown;
+
+    // Ready queue: one FIFO per priority level, linked through the task ref,
+    // and a bitmap with bit p set while ReadyHead[p] is not empty
+    int ReadyHead[MAX_PRIORITY];
+    int ReadyTail[MAX_PRIORITY];
+    unsigned int ReadyMap;
+
+    // Under POLICY_EDF ready jobs are in a binary heap on their deadline.
+    // The level FIFOs hold the jobs that may not start yet because their
+    // preemption level is not above SystemCeiling, the highest ceiling of
+    // the held resources (-1 if none). CeilingTop is the last of them
+    // taken, each one saves the system ceiling it raised.
+    int SchedulingPolicy;
+    int SystemCeiling;
+    int CeilingTop;
+    TEdfEntry EdfHeap[MAX_TASK];
+    int EdfCount;
+    int EdfTailSequence;
+    int EdfHeadSequence;
+
+    // Counters and their alarms, the task timers are on the wheel of
+    // the system counter
+    TCounter CounterQueue[MAX_COUNTER];
+    TAlarm AlarmQueue[MAX_ALARM];
+    int CounterCount;
+    int AlarmCount;
+
+    int SystemTick;
+
+    // Run statistics, reset by StartOS()
+    int ContextSwitches;
+    int DeadlineMisses;
+    int MaxResponse;
+    TStatsRecord TaskStats[MAX_TASK_STATS];
+    int TaskStatsCount;
+    TStatsName TaskStatsNames[STATS_NAME_SLOTS];
+    FILE* StatsOutput;          // DumpTaskStats() at ShutdownOS(), NULL for none
+
+    // Scratch space of AnalyzeSchedulability(), which runs on task stacks:
+    // the analysed tasks in priority order, the longest critical section
+    // of every slot and the user ceiling of every resource
+    TAnalysisTask AnalysisTasks[MAX_TASK];
+    int AnalysisSections[MAX_TASK];
+    int AnalysisCeilings[MAX_RES];
+
+    // Reaction to a deadline miss, AbortPending ends the active context
+    // once the tick that found it late was processed
+    int DeadlineReaction;
+    TDeadlineHook* DeadlineHook;
+    int AbortPending;
+
+    // Context of StartOS(), the task contexts are in their slots
+    TContext OsContext;
+
+    // Binary event trace
+    TTraceRecord TraceBuffer[TRACE_BUFFER_SIZE];
+    uint32_t TraceHead;
+
+} TKernel;
+
+extern thread_local TKernel* CurrentKernel;
+
+// Kernel code names the state of the current kernel like plain globals
+#define TaskQueue (CurrentKernel->TaskQueue)
+#define TaskCount (CurrentKernel->TaskCount)
+#define ResourceQueue (CurrentKernel->ResourceQueue)
+#define ResourceUse (CurrentKernel->ResourceUse)
+#define ResourceUseCount (CurrentKernel->ResourceUseCount)
+#define EventQueue (CurrentKernel->EventQueue)
+#define MessageQueue (CurrentKernel->MessageQueue)
+#define QueueStorage (CurrentKernel->QueueStorage)
+#define BufferPool (CurrentKernel->BufferPool)
+#define BufferStorage (CurrentKernel->BufferStorage)
+#define RunningTask (CurrentKernel->RunningTask)
+#define FreeTask (CurrentKernel->FreeTask)
+#define FreeResource (CurrentKernel->FreeResource)
+#define FreeEvent (CurrentKernel->FreeEvent)
+#define QueueCount (CurrentKernel->QueueCount)
+#define QueueStorageUsed (CurrentKernel->QueueStorageUsed)
+#define PoolCount (CurrentKernel->PoolCount)
+#define BufferStorageUsed (CurrentKernel->BufferStorageUsed)
+#define ActiveContext (CurrentKernel->ActiveContext)
+#define SchedulerLock (CurrentKernel->SchedulerLock)
+#define OsShutdown (CurrentKernel->OsShutdown)
+#define ReadyHead (CurrentKernel->ReadyHead)
+#define ReadyTail (CurrentKernel->ReadyTail)
+#define ReadyMap (CurrentKernel->ReadyMap)
+#define SchedulingPolicy (CurrentKernel->SchedulingPolicy)
+#define SystemCeiling (CurrentKernel->SystemCeiling)
+#define CeilingTop (CurrentKernel->CeilingTop)
+#define EdfHeap (CurrentKernel->EdfHeap)
+#define EdfCount (CurrentKernel->EdfCount)
+#define EdfTailSequence (CurrentKernel->EdfTailSequence)
+#define EdfHeadSequence (CurrentKernel->EdfHeadSequence)
+#define CounterQueue (CurrentKernel->CounterQueue)
+#define AlarmQueue (CurrentKernel->AlarmQueue)
+#define CounterCount (CurrentKernel->CounterCount)
+#define AlarmCount (CurrentKernel->AlarmCount)
+#define SystemTick (CurrentKernel->SystemTick)
+#define ContextSwitches (CurrentKernel->ContextSwitches)
+#define DeadlineMisses (CurrentKernel->DeadlineMisses)
+#define MaxResponse (CurrentKernel->MaxResponse)
+#define TaskStats (CurrentKernel->TaskStats)
+#define TaskStatsCount (CurrentKernel->TaskStatsCount)
+#define TaskStatsNames (CurrentKernel->TaskStatsNames)
+#define StatsOutput (CurrentKernel->StatsOutput)
+#define AnalysisTasks (CurrentKernel->AnalysisTasks)
+#define AnalysisSections (CurrentKernel->AnalysisSections)
+#define AnalysisCeilings (CurrentKernel->AnalysisCeilings)
+#define DeadlineReaction (CurrentKernel->DeadlineReaction)
+#define DeadlineHook (CurrentKernel->DeadlineHook)
+#define AbortPending (CurrentKernel->AbortPending)
+#define OsContext (CurrentKernel->OsContext)
+#define TraceBuffer (CurrentKernel->TraceBuffer)
+#define TraceHead (CurrentKernel->TraceHead)
+
+// Only the kernel writes the ring and never blocks: one slot per event
+inline void TraceRecord(int type, int task, int arg)
+{
+    TTraceRecord* record = &TraceBuffer[TraceHead++ & (TRACE_BUFFER_SIZE - 1)];
+
+    record->tick = SystemTick;
+    record->type = (int16_t)type;
+    record->reserved = 0;
+    record->task = task;
+    record->arg = arg;
+}
+
+// First dispatch of the current job of a task
+inline void JobStarted(int task)
+{
+    if (TaskQueue[task].start == -1)
+        TaskQueue[task].start = SystemTick;
+}
+
+// Timer of a wheel by timer id
+#define TIMER(id) (IS_ALARM_TIMER(id) ? AlarmQueue[(id) - ALARM_TIMER_BASE].timer : TaskQueue.timer(id))
+#define SystemWheel (CounterQueue[SYSTEM_COUNTER].wheel)
 
 void Schedule(int task,int mode);
+void Unschedule(int task);
+int HighestReady(void);
+void StartParkedJobs(void);
+
+void Dispatch(void);
+void InitTasks(void);
+void FreeTaskPool(void);
+int TaskIndex(int handle);
+int TaskHandle(int task);
+int StartTask(void (*entry)(void), void* coroutine, int priority, char* name, int stats);
+void EndTask(int task);
+void AbortTask(int task);
+void ResumeCoTask(int task);
+void DestroyCoTasks(void);
+
+void InitContexts(void);
+void ResetContext(int task);
+void SwitchContext(int from, int to);
+void FreeContexts(void);
+
+void StopWaitEvent(int task);
+void StopWaitQueue(int task);
+void FreeInbox(int task);
+void FreeResources(int task);
+void StopWaitResource(int task);
+void CheckDeadlines(void);
+void AccountJob(int task);
+int FindTaskStats(const char* name);
+void RecordJob(int task);
 
-void Dispatch(int task);
+void InitWheel(TTimerWheel* wheel);
+void AdvanceWheel(TTimerWheel* wheel, int tick);
+void InitCounters(void);
+void AlarmExpired(int alarm);
+void StartTimer(int timer, int expire);
+void StopTimer(int timer);
+void AdvanceTimers(int tick);
+int NextTimerExpiry(void);
+void TimerExpired(int timer);
 
-void CheckDeadlines(void);
\ No newline at end of file
+#endif  // End of include guard
\ No newline at end of file
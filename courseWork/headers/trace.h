@@ -0,0 +1,106 @@
+/****************************************/
+/*           trace.h                    */
+/****************************************/
+
+#ifndef TRACE_H   // Include guard
+#define TRACE_H
+
+#include <stdio.h>
+
+// Trace levels, each level includes the ones below it
+#define TRACE_LEVEL_OFF 0          // No kernel output at all
+#define TRACE_LEVEL_ERRORS 1       // Invalid calls and exhausted tables
+#define TRACE_LEVEL_SCHEDULING 2   // Task state changes, resources, events
+#define TRACE_LEVEL_VERBOSE 3      // Everything, including call exits and idle ticks
+
+// Selected at build time (CMake RTOS_TRACE_LEVEL)
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_VERBOSE
+#endif
+
+// Disabled levels expand to nothing, their arguments are never evaluated
+#if TRACE_LEVEL >= TRACE_LEVEL_ERRORS
+#define TRACE_ERROR(...) printf(__VA_ARGS__)
+#else
+#define TRACE_ERROR(...) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_SCHEDULING
+#define TRACE_SCHEDULE(...) printf(__VA_ARGS__)
+#else
+#define TRACE_SCHEDULE(...) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+#define TRACE_VERBOSE(...) printf(__VA_ARGS__)
+#else
+#define TRACE_VERBOSE(...) ((void)0)
+#endif
+
+// Binary event trace: fixed-size records in a preallocated ring buffer,
+// decoded offline by the traceDecode tool (CMake RTOS_TRACE_BUFFER)
+
+#include <stdint.h>
+
+#define TRACE_BUFFER_SIZE 4096     // Records, must be a power of two
+
+#ifndef TRACE_DUMP_FILE
+#define TRACE_DUMP_FILE "rtos_trace.bin"   // Written by ShutdownOS()
+#endif
+
+#define TRACE_FILE_MAGIC 0x52545452   // "RTTR"
+#define TRACE_FILE_VERSION 2
+
+enum T_TraceEvent{
+    TRACE_EV_ACTIVATE,          // task = new task, arg = priority
+    TRACE_EV_SCHEDULE,          // task = scheduled task, arg = running task
+    TRACE_EV_DISPATCH,          // task = started task, arg = preempted task
+    TRACE_EV_TERMINATE,         // task = terminated task
+    TRACE_EV_RESOURCE_GET,      // task = owner, arg = resource priority
+    TRACE_EV_RESOURCE_RELEASE,  // task = owner, arg = resource priority
+    TRACE_EV_EVENT_SET,         // task = setter, arg = event id
+    TRACE_EV_EVENT_WAIT,        // task = waiter, arg = event id
+    TRACE_EV_DELAY,             // task = delayed task, arg = wakeup tick
+    TRACE_EV_WAKEUP,            // task = woken task
+    TRACE_EV_TICK,              // arg = tick
+    TRACE_EV_RESOURCE_BLOCK,    // task = blocked task, arg = owner
+    TRACE_EV_INHERIT,           // task = owner, arg = inherited priority
+    TRACE_EV_QUEUE_SEND,        // task = sender, arg = queue id
+    TRACE_EV_QUEUE_RECEIVE,     // task = receiver, arg = queue id
+    TRACE_EV_QUEUE_BLOCK,       // task = blocked task, arg = queue id
+    TRACE_EV_BUFFER_SEND,       // task = receiver, arg = pool id
+    TRACE_EV_ALARM,             // arg = expired alarm
+    TRACE_EV_DEADLINE_MISS,     // task = late job, arg = lateness so far
+    TRACE_EV_COUNT
+};
+
+typedef struct Type_trace_record
+{
+    int32_t tick;
+    int16_t type;
+    int16_t reserved;
+    int32_t task;
+    int32_t arg;
+
+} TTraceRecord;
+
+typedef struct Type_trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;         // Records that follow, oldest first
+    uint32_t dropped;       // Older records overwritten by the ring
+
+} TTraceHeader;
+
+// TraceRecord() writes into the ring of the current kernel (sys.h)
+#ifdef RTOS_TRACE_BUFFER
+#define TRACE_RECORD(type, task, arg) TraceRecord(type, task, arg)
+#else
+#define TRACE_RECORD(type, task, arg) ((void)0)
+#endif
+
+int TraceDump(const char* path);
+
+#endif  // End of include guard
@@ -0,0 +1,309 @@
+/*************************************/
+/*              alarm.cpp              */
+/*************************************/
+
+#include <limits.h>
+
+#include "sys.h"
+#include "trace.h"
+#include "rtos_api.h"
+
+// Counters and alarms (OSEK). An alarm is a timer on the wheel of its
+// counter, so a tick only touches the alarms that expire on it. Expiry
+// actions run while the scheduler is locked, the task switch they cause
+// happens once all due alarms ran.
+
+static_assert(MAX_COUNTER >= 1, "The system counter is counter 0");
+
+static TCounter* FindCounter(int counter_id)
+{
+    if (counter_id < 0 || counter_id >= CounterCount)
+    {
+        TRACE_ERROR("ERROR: Invalid counter ID\n");
+        return NULL;
+    }
+
+    return &CounterQueue[counter_id];
+}
+
+static TAlarm* FindAlarm(int alarm_id)
+{
+    if (alarm_id < 0 || alarm_id >= AlarmCount)
+    {
+        TRACE_ERROR("ERROR: Invalid alarm ID\n");
+        return NULL;
+    }
+
+    return &AlarmQueue[alarm_id];
+}
+
+static int CounterValue(TCounter* counter)
+{
+    if (counter->max_value == INT_MAX)
+        return counter->wheel.tick;
+
+    return counter->wheel.tick % (counter->max_value + 1);
+}
+
+static void StartAlarm(int alarm_id, int delta, int cycle)
+{
+    TAlarm* alarm = &AlarmQueue[alarm_id];
+
+    alarm->cycle = cycle;
+    alarm->active = 1;
+
+    StartTimer(ALARM_TIMER(alarm_id), CounterQueue[alarm->counter].wheel.tick + delta);
+}
+
+void InitCounters(void)
+{
+    InitWheel(&SystemWheel);
+    CounterQueue[SYSTEM_COUNTER].max_value = INT_MAX;
+    CounterQueue[SYSTEM_COUNTER].name = (char*)"SystemCounter";
+
+    CounterCount = 1;
+    AlarmCount = 0;
+}
+
+int CreateCounter(int max_value, char* name)
+{
+    TCounter* counter;
+
+    if (max_value <= 0)
+    {
+        TRACE_ERROR("ERROR: Invalid counter range\n");
+        return -1;
+    }
+
+    if (CounterCount >= MAX_COUNTER)
+    {
+        TRACE_ERROR("ERROR: No free counter for %s\n", name);
+        return -1;
+    }
+
+    counter = &CounterQueue[CounterCount];
+
+    InitWheel(&counter->wheel);
+    counter->max_value = max_value;
+    counter->name = name;
+
+    TRACE_SCHEDULE("Counter %s created\n", name);
+
+    return CounterCount++;
+}
+
+// Software counters only, the system counter follows SystemTick
+int IncrementCounter(int counter_id)
+{
+    TCounter* counter = FindCounter(counter_id);
+
+    if (counter == NULL) return -1;
+
+    if (counter_id == SYSTEM_COUNTER)
+    {
+        TRACE_ERROR("ERROR: The system counter is driven by the tick\n");
+        return -1;
+    }
+
+    SchedulerLock++;
+    AdvanceWheel(&counter->wheel, counter->wheel.tick + 1);
+    SchedulerLock--;
+
+    // Same as CheckDeadlines(), the OS context dispatches from StartOS()
+    if (ActiveContext != -1)
+    {
+        Dispatch();
+    }
+
+    return 0;
+}
+
+int GetCounterValue(int counter_id, int* value)
+{
+    TCounter* counter = FindCounter(counter_id);
+
+    if (counter == NULL || value == NULL) return -1;
+
+    *value = CounterValue(counter);
+
+    return 0;
+}
+
+int CreateAlarm(int counter_id, TAlarmAction action, char* name)
+{
+    TAlarm* alarm;
+    int valid;
+
+    if (FindCounter(counter_id) == NULL) return -1;
+
+    valid = (action.type == ALARM_ACTIVATE_TASK && action.entry != NULL &&
+             action.priority >= 0 && action.priority < MAX_PRIORITY) ||
+            (action.type == ALARM_SET_EVENT && action.mask != 0) ||
+            (action.type == ALARM_CALLBACK && action.callback != NULL);
+
+    if (!valid)
+    {
+        TRACE_ERROR("ERROR: Invalid action for alarm %s\n", name);
+        return -1;
+    }
+
+    if (AlarmCount >= MAX_ALARM)
+    {
+        TRACE_ERROR("ERROR: No free alarm for %s\n", name);
+        return -1;
+    }
+
+    alarm = &AlarmQueue[AlarmCount];
+
+    alarm->timer.slot = -1;
+    alarm->counter = counter_id;
+    alarm->cycle = 0;
+    alarm->active = 0;
+    alarm->action = action;
+    alarm->stats = (action.type == ALARM_ACTIVATE_TASK) ? FindTaskStats(action.name) : -1;
+    alarm->name = name;
+
+    return AlarmCount++;
+}
+
+int SetRelAlarm(int alarm_id, int increment, int cycle)
+{
+    TAlarm* alarm = FindAlarm(alarm_id);
+    int max_value;
+
+    if (alarm == NULL) return -1;
+
+    max_value = CounterQueue[alarm->counter].max_value;
+
+    if (increment <= 0 || increment > max_value || cycle < 0 || cycle > max_value)
+    {
+        TRACE_ERROR("ERROR: Invalid alarm increment or cycle\n");
+        return -1;
+    }
+
+    if (alarm->active)
+    {
+        TRACE_ERROR("ERROR: Alarm %s is already set\n", alarm->name);
+        return -1;
+    }
+
+    TRACE_SCHEDULE("Alarm %s set in %d ticks, cycle %d\n", alarm->name, increment, cycle);
+
+    StartAlarm(alarm_id, increment, cycle);
+
+    return 0;
+}
+
+int SetAbsAlarm(int alarm_id, int start, int cycle)
+{
+    TAlarm* alarm = FindAlarm(alarm_id);
+    TCounter* counter;
+    int value, delta;
+
+    if (alarm == NULL) return -1;
+
+    counter = &CounterQueue[alarm->counter];
+
+    if (start < 0 || start > counter->max_value || cycle < 0 || cycle > counter->max_value)
+    {
+        TRACE_ERROR("ERROR: Invalid alarm start or cycle\n");
+        return -1;
+    }
+
+    if (alarm->active)
+    {
+        TRACE_ERROR("ERROR: Alarm %s is already set\n", alarm->name);
+        return -1;
+    }
+
+    value = CounterValue(counter);
+
+    // A wrapping counter reaches every value again, the system counter does not
+    if (counter->max_value == INT_MAX)
+    {
+        if (start <= value)
+        {
+            TRACE_ERROR("ERROR: Alarm %s starts at a tick that passed\n", alarm->name);
+            return -1;
+        }
+
+        delta = start - value;
+    }
+    else
+    {
+        delta = start - value;
+        if (delta <= 0)
+            delta += counter->max_value + 1;
+    }
+
+    TRACE_SCHEDULE("Alarm %s set at %d, cycle %d\n", alarm->name, start, cycle);
+
+    StartAlarm(alarm_id, delta, cycle);
+
+    return 0;
+}
+
+int CancelAlarm(int alarm_id)
+{
+    TAlarm* alarm = FindAlarm(alarm_id);
+
+    if (alarm == NULL) return -1;
+
+    if (!alarm->active)
+    {
+        TRACE_VERBOSE("Alarm %s is not set\n", alarm->name);
+        return -1;
+    }
+
+    StopTimer(ALARM_TIMER(alarm_id));
+    alarm->active = 0;
+
+    return 0;
+}
+
+int GetAlarm(int alarm_id, int* ticks)
+{
+    TAlarm* alarm = FindAlarm(alarm_id);
+
+    if (alarm == NULL || ticks == NULL) return -1;
+
+    if (!alarm->active)
+    {
+        TRACE_VERBOSE("Alarm %s is not set\n", alarm->name);
+        return -1;
+    }
+
+    *ticks = alarm->timer.expire - CounterQueue[alarm->counter].wheel.tick;
+
+    return 0;
+}
+
+// Run the action of an alarm that reached its expiry, a cyclic alarm is
+// restarted from its expiry so it does not drift
+void AlarmExpired(int alarm_id)
+{
+    TAlarm* alarm = &AlarmQueue[alarm_id];
+
+    TRACE_SCHEDULE("Alarm %s expired\n", alarm->name);
+    TRACE_RECORD(TRACE_EV_ALARM, -1, alarm_id);
+
+    if (alarm->cycle > 0)
+        StartTimer(ALARM_TIMER(alarm_id), alarm->timer.expire + alarm->cycle);
+    else
+        alarm->active = 0;
+
+    switch (alarm->action.type)
+    {
+    case ALARM_ACTIVATE_TASK:
+        StartTask(alarm->action.entry, NULL, alarm->action.priority, (char*)alarm->action.name, alarm->stats);
+        break;
+
+    case ALARM_SET_EVENT:
+        SetEvent(alarm->action.task_id, alarm->action.mask);
+        break;
+
+    case ALARM_CALLBACK:
+        alarm->action.callback();
+        break;
+    }
+}
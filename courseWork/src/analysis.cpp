@@ -0,0 +1,288 @@
+/*************************************/
+/*            analysis.cpp             */
+/*************************************/
+
+#include <math.h>
+
+#include "sys.h"
+#include "trace.h"
+#include "rtos_api.h"
+
+// Schedulability of the periodic tasks (period > 0) that declared a WCET.
+// Periodic task slots live until shutdown, so the analysis walks the
+// slots and needs no task list of its own. Their parameters are copied
+// once into AnalysisTasks in priority order, the fixed point iterations
+// only read that array. The scratch arrays are kernel state, nothing
+// sized by the kernel limits lives on the stack of the calling task.
+
+// The analysis checks a deadline past the period against the period,
+// which is safe but no longer exact
+static int AnalysisDeadline(int task)
+{
+    int deadline = TaskQueue[task].deadline;
+
+    if (deadline <= 0 || deadline > TaskQueue[task].period)
+        return TaskQueue[task].period;
+
+    return deadline;
+}
+
+// Highest priority of the tasks that declared a critical section on
+// each resource: what an inheritance resource can raise its owner to
+static void UserCeilings(void)
+{
+    int* ceilings = AnalysisCeilings;
+    int i, task;
+
+    for (i = 0; i < MAX_RES; i++)
+    {
+        ceilings[i] = -1;
+    }
+
+    for (i = 0; i < ResourceUseCount; i++)
+    {
+        task = TaskIndex(ResourceUse[i].task);
+
+        if (task != -1 && TaskQueue[task].priority > ceilings[ResourceUse[i].resource])
+            ceilings[ResourceUse[i].resource] = TaskQueue[task].priority;
+    }
+}
+
+// Longest time a task of the priority waits for lower priority tasks in
+// their critical sections. With ceilings this happens once per job: the
+// longest section on a resource whose ceiling reaches the priority. With
+// inheritance every lower priority task can block it once, so their
+// longest sections add up, per slot in AnalysisSections.
+static int Blocking(int priority)
+{
+    const int* ceilings = AnalysisCeilings;
+    int* longest = AnalysisSections;
+    int i, lower, resource, blocking;
+
+    blocking = 0;
+
+    for (lower = 0; lower < TaskCount; lower++)
+    {
+        longest[lower] = 0;
+    }
+
+    for (i = 0; i < ResourceUseCount; i++)
+    {
+        lower = TaskIndex(ResourceUse[i].task);
+        resource = ResourceUse[i].resource;
+
+        if (lower == -1 || TaskQueue[lower].priority >= priority) continue;
+
+        if (ResourceQueue[resource].protocol == RESOURCE_CEILING)
+        {
+            if (ResourceQueue[resource].priority >= priority && ResourceUse[i].ticks > blocking)
+                blocking = ResourceUse[i].ticks;
+        }
+        else if (ceilings[resource] >= priority && ResourceUse[i].ticks > longest[lower])
+        {
+            longest[lower] = ResourceUse[i].ticks;
+        }
+    }
+
+    for (lower = 0; lower < TaskCount; lower++)
+    {
+        blocking += longest[lower];
+    }
+
+    return blocking;
+}
+
+// Response time analysis of tasks[k]: the smallest fixed point of
+//     R = C + B + sum over higher priority tasks j of ceil(R / T_j) * C_j
+// Equal priorities run in FIFO order, so they interfere like higher ones.
+// -1 once R passes the deadline.
+static int ResponseTime(const TAnalysisTask* tasks, int count, int k)
+{
+    int j, response, next;
+
+    response = tasks[k].wcet + tasks[k].blocking;
+
+    while (response <= tasks[k].deadline)
+    {
+        next = tasks[k].wcet + tasks[k].blocking;
+
+        for (j = 0; j < count && tasks[j].priority >= tasks[k].priority; j++)
+        {
+            if (j != k)
+                next += (response + tasks[j].period - 1) / tasks[j].period * tasks[j].wcet;
+        }
+
+        if (next == response) return response;
+
+        response = next;
+    }
+
+    return -1;
+}
+
+// EDF with SRP (Baker): for every task k the demand of the tasks with
+// deadlines up to D_k plus the blocking of k fits, sufficient test
+static bool EdfFeasible(const TAnalysisTask* tasks, int count)
+{
+    int k, j;
+    double density;
+
+    for (k = 0; k < count; k++)
+    {
+        density = (double)tasks[k].blocking / tasks[k].deadline;
+
+        for (j = 0; j < count; j++)
+        {
+            if (tasks[j].deadline <= tasks[k].deadline)
+                density += (double)tasks[j].wcet / tasks[j].deadline;
+        }
+
+        if (density > 1.0) return false;
+    }
+
+    return true;
+}
+
+int AnalyzeSchedulability(TSchedulability* result)
+{
+    TAnalysisTask* tasks = AnalysisTasks;
+    int task, count, i, k;
+    double utilization;
+
+    if (result == NULL) return -1;
+
+    UserCeilings();
+
+    // Insertion in priority order, equal priorities keep the slot order
+    count = 0;
+    for (task = 0; task < TaskCount; task++)
+    {
+        TaskQueue[task].response_bound = -1;
+
+        if (TaskQueue[task].period <= 0 || TaskQueue[task].wcet <= 0) continue;
+
+        for (i = count; i > 0 && tasks[i - 1].priority < TaskQueue[task].priority; i--)
+        {
+            tasks[i] = tasks[i - 1];
+        }
+
+        tasks[i].task = task;
+        tasks[i].priority = TaskQueue[task].priority;
+        tasks[i].period = TaskQueue[task].period;
+        tasks[i].deadline = AnalysisDeadline(task);
+        tasks[i].wcet = TaskQueue[task].wcet;
+        tasks[i].blocking = Blocking(tasks[i].priority);
+        count++;
+    }
+
+    result->tasks = count;
+    result->utilization = 0.0;
+    result->hyperbolic = 1.0;
+    result->response_time = 1;
+    result->failed_task = -1;
+
+    for (k = 0; k < count; k++)
+    {
+        task = tasks[k].task;
+        utilization = (double)tasks[k].wcet / tasks[k].period;
+
+        result->utilization += utilization;
+        result->hyperbolic *= utilization + 1.0;
+
+        TaskQueue[task].response_bound = ResponseTime(tasks, count, k);
+
+        TRACE_VERBOSE("Task %s: wcet %d, blocking %d, response %d, deadline %d\n", TaskQueue[task].name,
+                      tasks[k].wcet, tasks[k].blocking, TaskQueue[task].response_bound, tasks[k].deadline);
+
+        // The tasks are in priority order, the first one to fail is the highest
+        if (TaskQueue[task].response_bound == -1 && result->response_time)
+        {
+            result->response_time = 0;
+            result->failed_task = TaskHandle(task);
+        }
+    }
+
+    result->liu_layland_bound = (count > 0) ? count * (pow(2.0, 1.0 / count) - 1.0) : 1.0;
+    result->liu_layland = result->utilization <= result->liu_layland_bound;
+    result->hyperbolic_ok = result->hyperbolic <= 2.0;
+    result->edf = EdfFeasible(tasks, count);
+
+    TRACE_SCHEDULE("Schedulability of %d tasks: utilization %.3f, Liu-Layland %s, hyperbolic %s, "
+                   "response times %s, EDF %s\n", count, result->utilization,
+                   result->liu_layland ? "met" : "exceeded", result->hyperbolic_ok ? "met" : "exceeded",
+                   result->response_time ? "met" : "missed", result->edf ? "feasible" : "infeasible");
+
+    return 0;
+}
+
+void SetTaskWcet(int task_id, int wcet)
+{
+    int task = TaskIndex(task_id);
+
+    if (task == -1 || wcet < 0)
+    {
+        TRACE_ERROR("ERROR: Invalid task ID or WCET\n");
+        return;
+    }
+
+    TaskQueue[task].wcet = wcet;
+
+    TRACE_VERBOSE("Task %s WCET set to %d\n", TaskQueue[task].name, wcet);
+}
+
+int SetResourceUse(int task_id, int resource, int ticks)
+{
+    int i, slot;
+
+    if (TaskIndex(task_id) == -1 || resource < 0 || resource >= MAX_RES ||
+        !ResourceQueue[resource].persistent || ticks < 0)
+    {
+        TRACE_ERROR("ERROR: Invalid task ID, resource handle or critical section\n");
+        return -1;
+    }
+
+    // A task declares one section per resource, the entries of ended
+    // tasks are reused
+    slot = -1;
+    for (i = 0; i < ResourceUseCount; i++)
+    {
+        if (ResourceUse[i].task == task_id && ResourceUse[i].resource == resource)
+        {
+            ResourceUse[i].ticks = ticks;
+            return 0;
+        }
+
+        if (slot == -1 && TaskIndex(ResourceUse[i].task) == -1)
+            slot = i;
+    }
+
+    if (slot == -1)
+    {
+        if (ResourceUseCount >= MAX_RESOURCE_USE)
+        {
+            TRACE_ERROR("ERROR: No free critical section slots\n");
+            return -1;
+        }
+
+        slot = ResourceUseCount++;
+    }
+
+    ResourceUse[slot].task = task_id;
+    ResourceUse[slot].resource = resource;
+    ResourceUse[slot].ticks = ticks;
+
+    return 0;
+}
+
+int GetResponseBound(int task_id)
+{
+    int task = TaskIndex(task_id);
+
+    if (task == -1)
+    {
+        TRACE_ERROR("ERROR: Invalid task ID\n");
+        return -1;
+    }
+
+    return TaskQueue[task].response_bound;
+}
@@ -0,0 +1,265 @@
+/*************************************/
+/*             buffer.cpp              */
+/*************************************/
+
+#include "sys.h"
+#include "trace.h"
+#include "rtos_api.h"
+
+// Fixed-block buffer pools in BufferStorage. A producer allocates a
+// block, fills it and sends the pointer to a consumer task: the block
+// goes into the inbox of that task and the task gets its events, the
+// payload itself is never copied. Blocks are carved out when the pool
+// is created, allocation only pops the free list.
+
+#define BUFFER_ALIGN 16
+
+static_assert(sizeof(TBufferHeader) % BUFFER_ALIGN == 0, "Block data stays aligned after the header");
+
+static TBufferHeader* BufferHeader(int offset)
+{
+    return (TBufferHeader*)&BufferStorage[offset];
+}
+
+// Header of a block handed out by AllocBuffer(), NULL if it is none
+static TBufferHeader* FindHeader(void* buffer)
+{
+    char* data = (char*)buffer;
+    TBufferHeader* header;
+    TBufferPool* pool;
+    int offset;
+
+    if (data < BufferStorage + sizeof(TBufferHeader) || data >= BufferStorage + BufferStorageUsed)
+        return NULL;
+
+    offset = (int)(data - BufferStorage) - (int)sizeof(TBufferHeader);
+
+    if (offset % BUFFER_ALIGN != 0) return NULL;
+
+    header = BufferHeader(offset);
+
+    if (header->pool < 0 || header->pool >= PoolCount) return NULL;
+
+    pool = &BufferPool[header->pool];
+    if ((offset - pool->storage) % pool->block_size != 0) return NULL;
+
+    return header;
+}
+
+static void PutBlock(TBufferHeader* header)
+{
+    TBufferPool* pool = &BufferPool[header->pool];
+
+    header->state = BUFFER_FREE;
+    header->owner = -1;
+    header->next = pool->free;
+    pool->free = (int)((char*)header - BufferStorage);
+
+    pool->freed++;
+    pool->in_use--;
+}
+
+int CreateBufferPool(int block_size, int count, char* name)
+{
+    TBufferPool* pool;
+    TBufferHeader* header;
+    int stride, offset, i;
+
+    if (block_size <= 0 || count <= 0)
+    {
+        TRACE_ERROR("ERROR: Invalid buffer pool size\n");
+        return -1;
+    }
+
+    stride = (int)sizeof(TBufferHeader) + (block_size + BUFFER_ALIGN - 1) / BUFFER_ALIGN * BUFFER_ALIGN;
+
+    if (PoolCount >= MAX_POOL || count > (BUFFER_STORAGE_SIZE - BufferStorageUsed) / stride)
+    {
+        TRACE_ERROR("ERROR: No room for buffer pool %s\n", name);
+        return -1;
+    }
+
+    pool = &BufferPool[PoolCount];
+
+    pool->storage = BufferStorageUsed;
+    pool->block_size = stride;
+    pool->count = count;
+    pool->free = -1;
+    pool->allocated = 0;
+    pool->freed = 0;
+    pool->failed = 0;
+    pool->in_use = 0;
+    pool->peak = 0;
+    pool->name = name;
+
+    // Free list in address order
+    for (i = count - 1; i >= 0; i--)
+    {
+        offset = pool->storage + i * stride;
+        header = BufferHeader(offset);
+
+        header->pool = PoolCount;
+        header->next = pool->free;
+        header->owner = -1;
+        header->state = BUFFER_FREE;
+
+        pool->free = offset;
+    }
+
+    BufferStorageUsed += count * stride;
+
+    TRACE_SCHEDULE("Buffer pool %s created with %d blocks of %d bytes\n", name, count, block_size);
+
+    return PoolCount++;
+}
+
+void* AllocBuffer(int pool_id)
+{
+    TBufferPool* pool;
+    TBufferHeader* header;
+
+    if (pool_id < 0 || pool_id >= PoolCount)
+    {
+        TRACE_ERROR("ERROR: Invalid buffer pool ID\n");
+        return NULL;
+    }
+
+    pool = &BufferPool[pool_id];
+
+    if (pool->free == -1)
+    {
+        pool->failed++;
+        TRACE_VERBOSE("Buffer pool %s is empty\n", pool->name);
+        return NULL;
+    }
+
+    header = BufferHeader(pool->free);
+    pool->free = header->next;
+
+    header->next = -1;
+    header->owner = RunningTask;
+    header->state = BUFFER_OWNED;
+
+    pool->allocated++;
+    pool->in_use++;
+    if (pool->in_use > pool->peak)
+        pool->peak = pool->in_use;
+
+    return header + 1;
+}
+
+int FreeBuffer(void* buffer)
+{
+    TBufferHeader* header = FindHeader(buffer);
+
+    if (header == NULL || header->state != BUFFER_OWNED)
+    {
+        TRACE_ERROR("ERROR: Invalid buffer\n");
+        return -1;
+    }
+
+    PutBlock(header);
+
+    return 0;
+}
+
+// Move a block into the inbox of a task, then deliver the events so a
+// task waiting for them wakes up like after SetEvent()
+int SendBuffer(int task_id, void* buffer, TEventMask mask)
+{
+    TBufferHeader* header = FindHeader(buffer);
+    int task = TaskIndex(task_id);
+    int offset;
+
+    if (task == -1)
+    {
+        TRACE_ERROR("ERROR: Invalid task ID\n");
+        return -1;
+    }
+
+    if (header == NULL || header->state != BUFFER_OWNED || header->owner != RunningTask)
+    {
+        TRACE_ERROR("ERROR: Buffer is not owned by the sender\n");
+        return -1;
+    }
+
+    TRACE_RECORD(TRACE_EV_BUFFER_SEND, task, header->pool);
+
+    offset = (int)((char*)header - BufferStorage);
+
+    header->next = -1;
+    header->owner = task;
+    header->state = BUFFER_SENT;
+
+    if (TaskQueue[task].inbox_head == -1)
+        TaskQueue[task].inbox_head = offset;
+    else
+        BufferHeader(TaskQueue[task].inbox_tail)->next = offset;
+
+    TaskQueue[task].inbox_tail = offset;
+
+    if (mask != 0)
+        SetEvent(task_id, mask);
+
+    return 0;
+}
+
+// Oldest block sent to the running task, it owns the block from now on
+void* ReceiveBuffer(void)
+{
+    TBufferHeader* header;
+
+    if (RunningTask == -1 || TaskQueue[RunningTask].inbox_head == -1)
+        return NULL;
+
+    header = BufferHeader(TaskQueue[RunningTask].inbox_head);
+
+    TaskQueue[RunningTask].inbox_head = header->next;
+    if (header->next == -1)
+        TaskQueue[RunningTask].inbox_tail = -1;
+
+    header->next = -1;
+    header->state = BUFFER_OWNED;
+
+    return header + 1;
+}
+
+int GetBufferStats(int pool_id, TBufferStats* stats)
+{
+    TBufferPool* pool;
+
+    if (pool_id < 0 || pool_id >= PoolCount || stats == NULL)
+    {
+        TRACE_ERROR("ERROR: Invalid buffer pool ID\n");
+        return -1;
+    }
+
+    pool = &BufferPool[pool_id];
+
+    stats->allocated = pool->allocated;
+    stats->freed = pool->freed;
+    stats->failed = pool->failed;
+    stats->in_use = pool->in_use;
+    stats->peak = pool->peak;
+
+    return 0;
+}
+
+// Blocks sent to a task that ends without taking them go back to their pool
+void FreeInbox(int task)
+{
+    TBufferHeader* header;
+
+    while (TaskQueue[task].inbox_head != -1)
+    {
+        header = BufferHeader(TaskQueue[task].inbox_head);
+        TaskQueue[task].inbox_head = header->next;
+
+        TRACE_ERROR("ERROR: Task %s ends with a buffer of pool %s in its inbox\n",
+                    TaskQueue[task].name, BufferPool[header->pool].name);
+
+        PutBlock(header);
+    }
+
+    TaskQueue[task].inbox_tail = -1;
+}
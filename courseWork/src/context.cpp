@@ -0,0 +1,168 @@
+/*************************************/
+/*             context.cpp             */
+/*************************************/
+
+#include <stdlib.h>
+
+#include "sys.h"
+#include "rtos_api.h"
+
+// Every task runs on its own stack, the OS context is the stack
+// StartOS() was called on. A task slot gets its context and stack the
+// first time it runs. Switching is a plain register swap: no
+// call frames pile up on the host stack when tasks preempt each other.
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+static void WINAPI TaskStart(LPVOID parameter)
+{
+    TaskQueue[(int)(INT_PTR)parameter].entry();
+
+    // Falling off the end of a task body terminates it
+    TerminateTask();
+}
+
+void InitContexts(void)
+{
+    int i;
+
+    OsContext = ConvertThreadToFiber(NULL);
+    if (OsContext == NULL)
+        OsContext = GetCurrentFiber();   // Already a fiber from an earlier StartOS
+
+    for (i = 0; i < TaskCount; i++)
+    {
+        ResetContext(i);
+    }
+}
+
+// Start the task from its entry point on its next switch
+void ResetContext(int task)
+{
+    // Fibers cannot be rewound, the old one is never the running fiber here
+    if (TaskQueue[task].context != NULL)
+        DeleteFiber(TaskQueue[task].context);
+
+    TaskQueue[task].context = NULL;
+}
+
+// Release the contexts before the kernel goes away
+void FreeContexts(void)
+{
+    int i;
+
+    for (i = 0; i < TaskCount; i++)
+    {
+        ResetContext(i);
+    }
+}
+
+void SwitchContext(int from, int to)
+{
+    ActiveContext = to;
+
+    if (to == -1)
+    {
+        SwitchToFiber(OsContext);
+        return;
+    }
+
+    if (TaskQueue[to].context == NULL)
+        TaskQueue[to].context = CreateFiber(TASK_STACK_SIZE, TaskStart, (LPVOID)(INT_PTR)to);
+
+    SwitchToFiber(TaskQueue[to].context);
+}
+
+#else
+
+// Saved registers and stack of a task, one allocation per slot
+typedef struct Type_context_block
+{
+    ucontext_t context;
+    alignas(16) char stack[TASK_STACK_SIZE];
+
+} TContextBlock;
+
+static void TaskStart(void)
+{
+    TaskQueue[ActiveContext].entry();
+
+    // Falling off the end of a task body terminates it
+    TerminateTask();
+}
+
+void InitContexts(void)
+{
+    int i;
+
+    for (i = 0; i < TaskCount; i++)
+    {
+        TaskQueue[i].fresh = 1;
+    }
+}
+
+// Start the task from its entry point on its next switch
+void ResetContext(int task)
+{
+    TaskQueue[task].fresh = 1;
+}
+
+// Release the stacks before the kernel goes away
+void FreeContexts(void)
+{
+    int i;
+
+    for (i = 0; i < TaskCount; i++)
+    {
+        free(TaskQueue[i].context);
+        TaskQueue[i].context = NULL;
+    }
+}
+
+void SwitchContext(int from, int to)
+{
+    ucontext_t* save;
+    ucontext_t* load;
+
+    save = (from == -1) ? &OsContext : &((TContextBlock*)TaskQueue[from].context)->context;
+
+    if (to != -1 && TaskQueue[to].context == NULL)
+    {
+        TaskQueue[to].context = malloc(sizeof(TContextBlock));
+
+        if (TaskQueue[to].context == NULL)
+        {
+            TRACE_ERROR("ERROR: No memory for the stack of task %s\n", TaskQueue[to].name);
+            OsShutdown = 1;
+            to = -1;
+        }
+    }
+
+    if (to == -1)
+    {
+        load = &OsContext;
+    }
+    else
+    {
+        load = &((TContextBlock*)TaskQueue[to].context)->context;
+
+        if (TaskQueue[to].fresh)
+        {
+            TaskQueue[to].fresh = 0;
+
+            getcontext(load);
+            load->uc_stack.ss_sp = ((TContextBlock*)TaskQueue[to].context)->stack;
+            load->uc_stack.ss_size = TASK_STACK_SIZE;
+            load->uc_link = &OsContext;
+            makecontext(load, TaskStart, 0);
+        }
+    }
+
+    ActiveContext = to;
+
+    swapcontext(save, load);
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*************************************/
+/*            coroutine.cpp            */
+/*************************************/
+
+#include "sys.h"
+#include "trace.h"
+#include "rtos_coro.h"
+
+void ActivateCoTask(TCoTaskCall entry, int priority, char* name)
+{
+    TCoTask task;
+
+    // The frame starts suspended, StartTask() only queues it
+    task = entry();
+
+    if (StartTask(NULL, task.frame.address(), priority, name, FindTaskStats(name)) == -1)
+    {
+        task.frame.destroy();
+    }
+}
+
+int CoTaskYields(void)
+{
+    return RunningTask != ActiveContext;
+}
+
+// Run a coroutine task on the OS context up to its next co_await
+void ResumeCoTask(int task)
+{
+    std::coroutine_handle<> frame;
+
+    frame = std::coroutine_handle<>::from_address(TaskQueue[task].coroutine);
+
+    TaskQueue.state(task) = TASK_RUNNING;
+    ContextSwitches++;
+    JobStarted(task);
+    TRACE_RECORD(TRACE_EV_DISPATCH, task, -1);
+
+    ActiveContext = task;
+    frame.resume();
+    ActiveContext = -1;
+
+    if (frame.done())
+    {
+        frame.destroy();
+        TaskQueue[task].coroutine = NULL;
+        EndTask(task);
+    }
+    else if (TaskQueue.state(task) == TASK_RUNNING)
+    {
+        // Suspended by a higher priority task, still ready
+        TaskQueue.state(task) = TASK_READY;
+    }
+}
+
+// Free the frames of coroutine tasks left over at shutdown
+void DestroyCoTasks(void)
+{
+    int i;
+
+    for (i = 0; i < TaskCount; i++)
+    {
+        if (TaskQueue[i].coroutine != NULL)
+        {
+            std::coroutine_handle<>::from_address(TaskQueue[i].coroutine).destroy();
+            TaskQueue[i].coroutine = NULL;
+        }
+    }
+}
@@ -3,86 +3,209 @@
 /*************************************/
 
 #include "sys.h"
+#include "trace.h"
 #include "rtos_api.h"
 #include <stdio.h>
 
 void SetEvent(int event_id, char* name)
 {
-    int i;
+    int task, next;
 
     if (event_id < 0 || event_id >= MAX_EVENT)
     {
-        printf("ERROR: Invalid event ID\n");
+        TRACE_ERROR("ERROR: Invalid event ID\n");
         return;
     }
 
-    printf("SetEvent %s\n", name);
+    TRACE_SCHEDULE("SetEvent %s\n", name);
+    TRACE_RECORD(TRACE_EV_EVENT_SET, RunningTask, event_id);
 
     EventQueue[event_id].status = EVENT_SET;
     EventQueue[event_id].name = name;
 
-    for (i = 0; i < MAX_TASK; i++)
+    task = EventQueue[event_id].waiting_head;
+
+    EventQueue[event_id].waiting_head = -1;
+    EventQueue[event_id].waiting_tail = -1;
+
+    // Make every waiter ready first, then switch at most once
+    while (task != -1)
     {
-        if (TaskQueue[i].waiting_event == event_id)
-        {
-            printf("Task %s woken up by event %s\n", TaskQueue[i].name, name);
-
-            TaskQueue[i].state = TASK_READY;
-            TaskQueue[i].waiting_event = -1;
-
-            Schedule(i, INSERT_TO_TAIL);
-
-            if (RunningTask != -1 &&
-                TaskQueue[i].ceiling_priority > TaskQueue[RunningTask].ceiling_priority)
-            {
-                int prev_running = RunningTask;
-                Dispatch(prev_running);
-            }
-        }
+        next = TaskQueue.ref(task);
+
+        TRACE_SCHEDULE("Task %s woken up by event %s\n", TaskQueue[task].name, name);
+
+        TaskQueue.state(task) = TASK_READY;
+        TaskQueue[task].waiting_event = -1;
+
+        Schedule(task, INSERT_TO_TAIL);
+
+        task = next;
     }
+
+    Dispatch();
 }
 
-void ClearEvent(int event_id, char* name)
+// Take a task that stops waiting without the event (ResumeTask) off the
+// wait list of its event
+void StopWaitEvent(int task)
+{
+    int event_id, cur, prev;
+
+    event_id = TaskQueue[task].waiting_event;
+    if (event_id == -1) return;
+
+    cur = EventQueue[event_id].waiting_head;
+    prev = -1;
+
+    while (cur != -1 && cur != task)
+    {
+        prev = cur;
+        cur = TaskQueue.ref(cur);
+    }
+
+    if (cur != -1)
+    {
+        if (prev == -1)
+            EventQueue[event_id].waiting_head = TaskQueue.ref(task);
+        else
+            TaskQueue.ref(prev) = TaskQueue.ref(task);
+
+        if (EventQueue[event_id].waiting_tail == task)
+            EventQueue[event_id].waiting_tail = prev;
+    }
+
+    TaskQueue.ref(task) = -1;
+    TaskQueue[task].waiting_event = -1;
+}
+
+void ClearEvent(int event_id, [[maybe_unused]] char* name)
 {
     if (event_id < 0 || event_id >= MAX_EVENT)
     {
-        printf("ERROR: Invalid event ID\n");
+        TRACE_ERROR("ERROR: Invalid event ID\n");
         return;
     }
 
-    printf("ClearEvent %s\n", name);
+    TRACE_SCHEDULE("ClearEvent %s\n", name);
 
     EventQueue[event_id].status = EVENT_CLEAR;
 }
 
-void WaitEvent(int event_id, char* name)
+void WaitEvent(int event_id, [[maybe_unused]] char* name)
 {
     if (event_id < 0 || event_id >= MAX_EVENT)
     {
-        printf("ERROR: Invalid event ID\n");
+        TRACE_ERROR("ERROR: Invalid event ID\n");
         return;
     }
 
-    printf("WaitEvent %s\n", name);
+    TRACE_SCHEDULE("WaitEvent %s\n", name);
+    TRACE_RECORD(TRACE_EV_EVENT_WAIT, RunningTask, event_id);
 
     if (EventQueue[event_id].status == EVENT_SET)
     {
-        printf("Event %s is already set, continuing\n", name);
+        TRACE_VERBOSE("Event %s is already set, continuing\n", name);
         return;
     }
 
     int current_task = RunningTask;
 
-    TaskQueue[current_task].state = TASK_WAITING;
+    TaskQueue.state(current_task) = TASK_WAITING;
     TaskQueue[current_task].waiting_event = event_id;
-    RunningTask = TaskQueue[current_task].ref;
+    Unschedule(current_task);
+
+    if (EventQueue[event_id].waiting_head == -1)
+        EventQueue[event_id].waiting_head = current_task;
+    else
+        TaskQueue.ref(EventQueue[event_id].waiting_tail) = current_task;
+
+    EventQueue[event_id].waiting_tail = current_task;
+
+    // Continues here once SetEvent() made us ready again
+    Dispatch();
+}
+
+// Deliver events to a task, it becomes ready if it waits for one of them
+void SetEvent(int task_id, TEventMask mask)
+{
+    int task = TaskIndex(task_id);
+
+    if (task == -1)
+    {
+        TRACE_ERROR("ERROR: Invalid task ID\n");
+        return;
+    }
+
+    TRACE_SCHEDULE("SetEvent 0x%llx for task %s\n", (unsigned long long)mask, TaskQueue[task].name);
+    TRACE_RECORD(TRACE_EV_EVENT_SET, task, (int)mask);
+
+    TaskQueue[task].events_set |= mask;
 
+    if (TaskQueue[task].events_set & TaskQueue[task].events_waited)
+    {
+        TRACE_SCHEDULE("Task %s woken up by its events\n", TaskQueue[task].name);
+
+        TaskQueue[task].events_waited = 0;
+        TaskQueue.state(task) = TASK_READY;
+
+        Schedule(task, INSERT_TO_TAIL);
+
+        Dispatch();
+    }
+}
+
+int GetEvent(int task_id, TEventMask* mask)
+{
+    int task = TaskIndex(task_id);
+
+    if (task == -1 || mask == NULL)
+    {
+        TRACE_ERROR("ERROR: Invalid task ID\n");
+        return -1;
+    }
+
+    *mask = TaskQueue[task].events_set;
+
+    return 0;
+}
+
+void ClearEvent(TEventMask mask)
+{
     if (RunningTask == -1)
     {
-        IdleLoop();
+        TRACE_ERROR("ERROR: ClearEvent outside of a task\n");
+        return;
     }
-    else
+
+    TaskQueue[RunningTask].events_set &= ~mask;
+}
+
+// Block until any event of the mask is delivered to the running task
+void WaitEvent(TEventMask mask)
+{
+    int current_task = RunningTask;
+
+    if (current_task == -1 || mask == 0)
+    {
+        TRACE_ERROR("ERROR: WaitEvent needs a running task and a mask\n");
+        return;
+    }
+
+    TRACE_SCHEDULE("WaitEvent 0x%llx\n", (unsigned long long)mask);
+    TRACE_RECORD(TRACE_EV_EVENT_WAIT, current_task, (int)mask);
+
+    if (TaskQueue[current_task].events_set & mask)
     {
-        Dispatch(current_task);
+        TRACE_VERBOSE("Events 0x%llx are already set, continuing\n",
+                      (unsigned long long)(TaskQueue[current_task].events_set & mask));
+        return;
     }
-}
\ No newline at end of file
+
+    TaskQueue.state(current_task) = TASK_WAITING;
+    TaskQueue[current_task].events_waited = mask;
+    Unschedule(current_task);
+
+    // Continues here once SetEvent() delivered one of the events
+    Dispatch();
+}
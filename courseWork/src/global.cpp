@@ -3,20 +3,39 @@
 /****************************************/
 
 #include "sys.h"
+#include "rtos_api.h"
 
-// System queues
-TTask TaskQueue[MAX_TASK];          // Task queue
-TResource ResourceQueue[MAX_RES];    // Resource queue
-TEvent EventQueue[MAX_EVENT];        // Event queue
-
-// System state variables
-int RunningTask = -1;                // No running task initially
-int FreeTask = 0;                    // First free task slot
-int FreeResource = 0;                // First free resource slot
-int FreeEvent = 0;                   // First free event slot
-
-// RMA specific variables
-int SystemTick = 0;                  // System tick counter
-int TaskPeriods[MAX_TASK];           // Array to store task periods
-int TaskDeadlines[MAX_TASK];         // Array to store task deadlines
-int TaskLastRun[MAX_TASK];           // Last run time for each task
\ No newline at end of file
+// System used by every thread that did not select one of its own
+static TKernel DefaultKernel;
+
+thread_local TKernel* CurrentKernel = &DefaultKernel;
+
+// A new system, StartOS() initializes it once it is selected
+TKernel* CreateKernel(void)
+{
+    return new TKernel();
+}
+
+void DeleteKernel(TKernel* kernel)
+{
+    TKernel* selected;
+
+    if (kernel == NULL || kernel == &DefaultKernel) return;
+
+    selected = CurrentKernel;
+
+    CurrentKernel = kernel;
+    DestroyCoTasks();
+    FreeContexts();
+    FreeTaskPool();
+
+    CurrentKernel = (selected == kernel) ? &DefaultKernel : selected;
+
+    delete kernel;
+}
+
+// Route the API calls of the calling thread to the given system
+void SelectKernel(TKernel* kernel)
+{
+    CurrentKernel = (kernel != NULL) ? kernel : &DefaultKernel;
+}
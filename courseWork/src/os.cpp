@@ -3,62 +3,177 @@
 /******************************/
 
 #include <stdio.h>
-#include <cstdlib>
+
 #include "sys.h"
+#include "trace.h"
 #include "rtos_api.h"
+#include "rtos_config.h"
 
-// External variable declarations
-extern int SystemTick;
-extern int TaskPeriods[MAX_TASK];
-extern int TaskDeadlines[MAX_TASK];
-extern int TaskLastRun[MAX_TASK];
-
-int StartOS(TTaskCall entry, int priority, char* name)
+static void InitKernel(void)
 {
     int i;
 
     // Initialize system state
     RunningTask = -1;
-    FreeTask = 0;
     FreeResource = 0;
+    ResourceUseCount = 0;
     FreeEvent = 0;
+    QueueCount = 0;
+    QueueStorageUsed = 0;
+    PoolCount = 0;
+    BufferStorageUsed = 0;
     SystemTick = 0;
+    ActiveContext = -1;
+    SchedulerLock = 0;
+    OsShutdown = 0;
+    ContextSwitches = 0;
+    DeadlineMisses = 0;
+    MaxResponse = 0;
+    TaskStatsCount = 0;
+    StatsOutput = stdout;
+    DeadlineReaction = DEADLINE_LOG;
+    DeadlineHook = NULL;
+    AbortPending = 0;
 
-    printf("StartOS!\n");
+    TRACE_SCHEDULE("StartOS!\n");
 
-    // Initialize task queue
-    for(i = 0; i < MAX_TASK; i++)
-    {
-        TaskQueue[i].ref = i + 1;
-        TaskQueue[i].state = TASK_READY;
-        TaskQueue[i].waiting_event = -1;
-        TaskPeriods[i] = 0;       // No periodic behavior by default
-        TaskDeadlines[i] = 0;     // No deadline by default
-        TaskLastRun[i] = 0;       // Not run yet
-    }
-    TaskQueue[MAX_TASK - 1].ref = -1;
+    // Initialize task queue, the pool keeps the slots of an earlier run
+    InitTasks();
 
     // Initialize resource queue
     for(i = 0; i < MAX_RES; i++)
     {
         ResourceQueue[i].priority = i + 1;
         ResourceQueue[i].task = -1;
+        ResourceQueue[i].persistent = 0;
+        ResourceQueue[i].waiting = -1;
     }
     ResourceQueue[MAX_RES - 1].priority = -1;
 
+    // Initialize ready queue
+    for(i = 0; i < MAX_PRIORITY; i++)
+    {
+        ReadyHead[i] = -1;
+        ReadyTail[i] = -1;
+    }
+    ReadyMap = 0;
+
+    SchedulingPolicy = POLICY_PRIORITY;
+    SystemCeiling = -1;
+    CeilingTop = -1;
+    EdfCount = 0;
+    EdfTailSequence = 0;
+    EdfHeadSequence = 0;
+
+    InitCounters();
+    InitContexts();
+
+    for(i = 0; i < STATS_NAME_SLOTS; i++)
+    {
+        TaskStatsNames[i].name = NULL;
+    }
+
     for(i = 0; i < MAX_EVENT; i++)
     {
         EventQueue[i].status = EVENT_CLEAR;
+        EventQueue[i].waiting_head = -1;
+        EventQueue[i].waiting_tail = -1;
+        EventQueue[i].name = NULL;
     }
+}
+
+// Runs the tasks until ShutdownOS(), we get back here once none of them
+// is ready or a coroutine task is next
+static void RunKernel(void)
+{
+    while (!OsShutdown)
+    {
+        if (RunningTask == -1)
+            IdleLoop();
+        else if (IS_COTASK(RunningTask))
+            ResumeCoTask(RunningTask);
+        else
+            Dispatch();
+    }
+
+    DestroyCoTasks();
+}
+
+int StartOS(TTaskCall entry, int priority, char* name)
+{
+    InitKernel();
 
     ActivateTask(entry, priority, name);
 
+    RunKernel();
+
+    return 0;
+}
+
+// The configuration was checked and its ceilings computed at compile time,
+// the kernel tables are built here through the regular calls
+int StartOS(const TSystemConfig* config)
+{
+    int i, task;
+    const TTaskConfig* task_config;
+
+    InitKernel();
+
+    // Resources first, so their handles are their table positions
+    for (i = 0; i < config->resource_count; i++)
+    {
+        CreateResource(config->ceilings[i], config->resources[i].protocol,
+                       (char*)config->resources[i].name);
+    }
+
+    for (i = 0; i < config->event_count; i++)
+    {
+        EventQueue[i].name = (char*)config->events[i].name;
+    }
+
+    // Autostart tasks become ready together, the first one runs from RunKernel()
+    SchedulerLock++;
+
+    for (i = 0; i < config->task_count; i++)
+    {
+        task_config = &config->tasks[i];
+
+        task = CreateTask(task_config->entry, task_config->priority, (char*)task_config->name);
+        if (task == -1) continue;
+
+        if (task_config->period > 0)
+            SetTaskPeriod(task, task_config->period);
+        if (task_config->deadline > 0)
+            SetTaskDeadline(task, task_config->deadline);
+        if (task_config->autostart)
+            ResumeTask(task);
+    }
+
+    SchedulerLock--;
+
+    RunKernel();
+
     return 0;
 }
 
 void ShutdownOS()
 {
-    printf("ShutdownOS!\n");
+    TRACE_SCHEDULE("ShutdownOS!\n");
+
+    OsShutdown = 1;
+
+    if (StatsOutput != NULL)
+        DumpTaskStats(StatsOutput);
+
+#ifdef RTOS_TRACE_BUFFER
+    TraceDump(TRACE_DUMP_FILE);
+#endif
+
+    // Called from a stackful task: return to StartOS() for good
+    if (ActiveContext != -1 && !IS_COTASK(ActiveContext))
+    {
+        SwitchContext(ActiveContext, -1);
+    }
 }
 /*
 void IdleLoop()
@@ -72,76 +187,279 @@ void IdleLoop()
         // Check if any periodic tasks need to be activated
         CheckDeadlines();
 
-        printf("System Idle. Tick: %d\n", SystemTick);
+        TRACE_VERBOSE("System Idle. Tick: %d\n", SystemTick);
     }
 }*/
 
 
 void IdleLoop()
 {
-    printf("DEBUG: Entered idle loop, RunningTask = %d\n", RunningTask);
+    TRACE_VERBOSE("DEBUG: Entered idle loop, RunningTask = %d\n", RunningTask);
 
-    int maxTicks = 30;
+    int maxTicks = IDLE_TICK_LIMIT;
     int currentTick = 0;
 
-    while(RunningTask == -1 && currentTick < maxTicks)
+    while(RunningTask == -1 && currentTick < maxTicks && !OsShutdown)
     {
+#ifdef RTOS_TICKLESS_IDLE
+        // Jump straight to the next timer instead of stepping through empty ticks
+        int next = NextTimerExpiry();
+        int step;
+
+        if (next == -1)
+        {
+            TRACE_VERBOSE("No pending timers, nothing can become ready\n");
+            currentTick = maxTicks;
+            break;
+        }
+
+        step = next - SystemTick;
+        if (step > maxTicks - currentTick) step = maxTicks - currentTick;
+        if (step < 1) step = 1;
+
+        SystemTick += step;
+        currentTick += step;
+#else
         SystemTick++;
         currentTick++;
+#endif
 
         CheckDeadlines();
 
-        printf("System Idle. Tick: %d\n", SystemTick);
+        TRACE_VERBOSE("System Idle. Tick: %d\n", SystemTick);
     }
 
     if (currentTick >= maxTicks) {
-        printf("DEBUG: Idle loop exited due to tick limit\n");
-        printf("DEBUG: No tasks were scheduled during idle period\n");
+        TRACE_SCHEDULE("DEBUG: Idle loop exited due to tick limit\n");
+        TRACE_SCHEDULE("DEBUG: No tasks were scheduled during idle period\n");
         ShutdownOS();
-        exit(1); // Force exit for debugging
     }
 }
 
+// Runs the wakeup and release timers that expired up to SystemTick
 void CheckDeadlines()
 {
-    int i;
+    TRACE_RECORD(TRACE_EV_TICK, -1, SystemTick);
+
+    // Expiry handlers only make tasks ready, switch once all of them ran
+    SchedulerLock++;
+    AdvanceTimers(SystemTick);
+    SchedulerLock--;
+
+    // The job processing this tick was found late and is aborted, it ends
+    // like TerminateTask(): the switch below never comes back
+    if (AbortPending)
+    {
+        AbortPending = 0;
+        EndTask(ActiveContext);
+    }
+
+    // The OS context dispatches from StartOS() when it leaves the idle loop
+    if (ActiveContext != -1)
+    {
+        Dispatch();
+    }
+}
+
+// A ready job takes its new place in the EDF heap
+static void ChangeDeadline(int task, int deadline)
+{
+    TaskQueue[task].deadline = deadline;
 
-    for(i = 0; i < MAX_TASK; i++)
+    if (TaskQueue[task].in_heap)
     {
-        if (TaskPeriods[i] <= 0) continue;
+        Unschedule(task);
+        Schedule(task, INSERT_TO_TAIL);
+    }
+}
+
+// Count a missed deadline once per job and react to it, lateness is
+// updated whenever the job is found later than before
+static void DeadlineMissed(int task, int lateness, int running)
+{
+    TTaskStats* stats = NULL;
+
+    if (TaskQueue[task].stats != -1)
+        stats = &TaskStats[TaskQueue[task].stats].stats;
+
+    if (stats != NULL && lateness > stats->max_lateness)
+        stats->max_lateness = lateness;
+
+    if (TaskQueue[task].late) return;
+
+    TaskQueue[task].late = 1;
+    DeadlineMisses++;
+    if (stats != NULL)
+        stats->misses++;
+
+    TRACE_RECORD(TRACE_EV_DEADLINE_MISS, task, lateness);
+
+    switch (DeadlineReaction)
+    {
+    case DEADLINE_LOG:
+        TRACE_SCHEDULE("Task %s missed its deadline by %d ticks\n", TaskQueue[task].name, lateness);
+        break;
+
+    case DEADLINE_HOOK:
+        DeadlineHook(TaskHandle(task), lateness);
+        break;
+
+    case DEADLINE_ABORT:
+        // A completed job has nothing left to abort
+        if (!running)
+        {
+            TRACE_SCHEDULE("Task %s missed its deadline by %d ticks\n", TaskQueue[task].name, lateness);
+            break;
+        }
+
+        TRACE_SCHEDULE("Task %s aborted %d ticks after its deadline\n", TaskQueue[task].name, lateness);
+
+        if (task == ActiveContext)
+            AbortPending = 1;
+        else if (!IS_COTASK(task))
+            AbortTask(task);
+        break;
+    }
+}
+
+// A job that has not completed when its task is released again is late
+// once its deadline passed
+static void CheckLateJob(int task)
+{
+    int lateness;
+
+    if (task == -1 || TaskQueue.state(task) == TASK_SUSPENDED || TaskQueue[task].deadline <= 0)
+        return;
+
+    lateness = SystemTick - (TaskQueue[task].last_run + TaskQueue[task].deadline);
+
+    if (lateness > 0)
+        DeadlineMissed(task, lateness, 1);
+}
+
+void TimerExpired(int timer)
+{
+    int task, job;
+
+    if (IS_ALARM_TIMER(timer))
+    {
+        AlarmExpired(timer - ALARM_TIMER_BASE);
+        return;
+    }
+
+    task = timer >> 1;
+
+    if (timer == WAKEUP_TIMER(task))
+    {
+        // Wakeup of a delayed task
+        if (TaskQueue.state(task) != TASK_WAITING) return;
 
-        if ((SystemTick - TaskLastRun[i]) >= TaskPeriods[i])
+        TRACE_SCHEDULE("Task %s woken up at tick %d\n", TaskQueue[task].name, SystemTick);
+        TRACE_RECORD(TRACE_EV_WAKEUP, task, 0);
+
+        TaskQueue.state(task) = TASK_READY;
+        Schedule(task, INSERT_TO_TAIL);
+        return;
+    }
+
+    // Periodic release
+    if (TaskQueue[task].period <= 0) return;
+
+    StartTimer(timer, SystemTick + TaskQueue[task].period);
+
+    // The task itself runs as a job after ResumeTask(), the others get a slot
+    CheckLateJob(task);
+    CheckLateJob(TaskIndex(TaskQueue[task].job));
+
+    // The current job has not finished yet, skip this release
+    if (TaskQueue.state(task) == TASK_RUNNING) return;
+
+    TaskQueue[task].last_run = SystemTick;
+
+    if (TaskQueue[task].entry != NULL)
+    {
+        // The job runs in a slot of its own, the scheduler is locked here
+        // so it cannot finish before it got the deadline of its template
+        job = StartTask(TaskQueue[task].entry, NULL, TaskQueue[task].priority, TaskQueue[task].name,
+                        TaskQueue[task].stats);
+        if (job != -1)
         {
-            if (TaskQueue[i].ref != -1 && TaskQueue[i].state != TASK_RUNNING)
-            {
-                TaskLastRun[i] = SystemTick;
-
-                if (TaskQueue[i].entry != NULL)
-                {
-                    ActivateTask(TaskQueue[i].entry, TaskQueue[i].priority, TaskQueue[i].name);
-                    printf("Periodic task %s activated at tick %d\n", TaskQueue[i].name, SystemTick);
-                }
-            }
+            ChangeDeadline(job, TaskQueue[task].deadline);
+            TaskQueue[task].job = TaskHandle(job);
         }
+        else
+            DeadlineMisses++;       // A release that never runs is late too
+        TRACE_SCHEDULE("Periodic task %s activated at tick %d\n", TaskQueue[task].name, SystemTick);
     }
 }
 
+// Response time of a finished job, measured from its activation. A job
+// that never ran (deleted or aborted before its first dispatch) has none.
+void AccountJob(int task)
+{
+    int response;
+
+    if (TaskQueue[task].start == -1) return;
+
+    response = SystemTick - TaskQueue[task].last_run;
+
+    if (response > MaxResponse)
+        MaxResponse = response;
+
+    if (TaskQueue[task].deadline > 0 && response > TaskQueue[task].deadline)
+    {
+        DeadlineMissed(task, response - TaskQueue[task].deadline, 0);
+    }
+
+    RecordJob(task);
+}
+
 // Sets the period for a task (for RMA)
 void SetTaskPeriod(int task_id, int period)
 {
-    if (task_id >= 0 && task_id < MAX_TASK)
+    int task = TaskIndex(task_id);
+
+    if (task == -1)
+    {
+        TRACE_ERROR("ERROR: Invalid task ID\n");
+    }
+    else
+    {
+        TaskQueue[task].period = period;
+
+        if (period > 0)
+            StartTimer(RELEASE_TIMER(task), TaskQueue[task].last_run + period);
+        else
+            StopTimer(RELEASE_TIMER(task));
+
+        TRACE_VERBOSE("Task %s period set to %d\n", TaskQueue[task].name, period);
+    }
+}
+
+void SetDeadlineReaction(int reaction, TDeadlineHook* hook)
+{
+    if (reaction < DEADLINE_LOG || reaction > DEADLINE_ABORT || (reaction == DEADLINE_HOOK && hook == NULL))
     {
-        TaskPeriods[task_id] = period;
-        printf("Task %s period set to %d\n", TaskQueue[task_id].name, period);
+        TRACE_ERROR("ERROR: Invalid deadline reaction\n");
+        return;
     }
+
+    DeadlineReaction = reaction;
+    DeadlineHook = hook;
 }
 
 // Sets the deadline for a task (for RMA)
 void SetTaskDeadline(int task_id, int deadline)
 {
-    if (task_id >= 0 && task_id < MAX_TASK)
+    int task = TaskIndex(task_id);
+
+    if (task == -1)
+    {
+        TRACE_ERROR("ERROR: Invalid task ID\n");
+    }
+    else
     {
-        TaskDeadlines[task_id] = deadline;
-        printf("Task %s deadline set to %d\n", TaskQueue[task_id].name, deadline);
+        ChangeDeadline(task, deadline);
+        TRACE_VERBOSE("Task %s deadline set to %d\n", TaskQueue[task].name, deadline);
     }
 }
@@ -0,0 +1,290 @@
+/*************************************/
+/*              queue.cpp              */
+/*************************************/
+
+#include <string.h>
+
+#include "sys.h"
+#include "trace.h"
+#include "rtos_api.h"
+
+// Message queues copy fixed-size messages through slots carved out of
+// QueueStorage when the queue is created. A message for a task that
+// already waits goes straight into the buffer of that task, the queue
+// slots are only used while nobody waits on the other side.
+
+static TQueue* GetQueue(int queue_id)
+{
+    if (queue_id < 0 || queue_id >= QueueCount)
+    {
+        TRACE_ERROR("ERROR: Invalid queue ID\n");
+        return NULL;
+    }
+
+    return &MessageQueue[queue_id];
+}
+
+static char* QueueSlot(TQueue* queue, int index)
+{
+    return &QueueStorage[queue->storage + (index % queue->length) * queue->message_size];
+}
+
+static void AppendWaiter(int* head, int* tail, int task)
+{
+    TaskQueue.ref(task) = -1;
+
+    if (*head == -1)
+        *head = task;
+    else
+        TaskQueue.ref(*tail) = task;
+
+    *tail = task;
+}
+
+static int TakeWaiter(int* head, int* tail)
+{
+    int task;
+
+    task = *head;
+    if (task == -1) return -1;
+
+    *head = TaskQueue.ref(task);
+    if (*head == -1)
+        *tail = -1;
+
+    return task;
+}
+
+// Unlink a task from a wait list, 0 if it was not in it
+static int RemoveWaiter(int* head, int* tail, int task)
+{
+    int cur, prev;
+
+    cur = *head;
+    prev = -1;
+
+    while (cur != -1 && cur != task)
+    {
+        prev = cur;
+        cur = TaskQueue.ref(cur);
+    }
+
+    if (cur == -1) return 0;
+
+    if (prev == -1)
+        *head = TaskQueue.ref(task);
+    else
+        TaskQueue.ref(prev) = TaskQueue.ref(task);
+
+    if (*tail == task)
+        *tail = prev;
+
+    return 1;
+}
+
+// The transfer of a waiting task is done, it becomes ready
+static void WakeWaiter(int task)
+{
+    TaskQueue[task].message = NULL;
+    TaskQueue[task].waiting_queue = -1;
+    TaskQueue.state(task) = TASK_READY;
+
+    Schedule(task, INSERT_TO_TAIL);
+}
+
+// Block the running task on a wait list until its message was moved,
+// -1 if the wait ended another way (ResumeTask)
+static int WaitQueue(int queue_id, int* head, int* tail, void* message)
+{
+    int current_task = RunningTask;
+
+    if (current_task == -1 || IS_COTASK(current_task))
+    {
+        TRACE_ERROR("ERROR: Only a stackful task can block on a queue\n");
+        return -1;
+    }
+
+    TRACE_SCHEDULE("Task %s waits on queue %s\n", TaskQueue[current_task].name,
+                   MessageQueue[queue_id].name);
+    TRACE_RECORD(TRACE_EV_QUEUE_BLOCK, current_task, queue_id);
+
+    TaskQueue.state(current_task) = TASK_WAITING;
+    TaskQueue[current_task].waiting_queue = queue_id;
+    TaskQueue[current_task].message = message;
+    Unschedule(current_task);
+
+    AppendWaiter(head, tail, current_task);
+
+    // Continues here once the other side moved the message
+    Dispatch();
+
+    if (TaskQueue[current_task].message != NULL)
+    {
+        TaskQueue[current_task].message = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int CreateQueue(int message_size, int length, char* name)
+{
+    TQueue* queue;
+    int size;
+
+    if (message_size <= 0 || length <= 0)
+    {
+        TRACE_ERROR("ERROR: Invalid queue size\n");
+        return -1;
+    }
+
+    size = message_size * length;
+
+    if (QueueCount >= MAX_QUEUE || size > QUEUE_STORAGE_SIZE - QueueStorageUsed)
+    {
+        TRACE_ERROR("ERROR: No room for queue %s\n", name);
+        return -1;
+    }
+
+    queue = &MessageQueue[QueueCount];
+
+    queue->storage = QueueStorageUsed;
+    queue->message_size = message_size;
+    queue->length = length;
+    queue->head = 0;
+    queue->count = 0;
+    queue->send_head = -1;
+    queue->send_tail = -1;
+    queue->receive_head = -1;
+    queue->receive_tail = -1;
+    queue->name = name;
+
+    QueueStorageUsed += size;
+
+    TRACE_SCHEDULE("Queue %s created with %d slots of %d bytes\n", name, length, message_size);
+
+    return QueueCount++;
+}
+
+static int PutMessage(int queue_id, const void* message, int blocking)
+{
+    TQueue* queue;
+    int task;
+
+    queue = GetQueue(queue_id);
+    if (queue == NULL || message == NULL) return -1;
+
+    // Receivers only wait while the queue is empty
+    task = TakeWaiter(&queue->receive_head, &queue->receive_tail);
+
+    if (task != -1)
+    {
+        TRACE_RECORD(TRACE_EV_QUEUE_SEND, RunningTask, queue_id);
+        TRACE_SCHEDULE("Message on queue %s handed to task %s\n", queue->name, TaskQueue[task].name);
+
+        memcpy(TaskQueue[task].message, message, queue->message_size);
+        WakeWaiter(task);
+
+        Dispatch();
+        return 0;
+    }
+
+    if (queue->count < queue->length)
+    {
+        TRACE_RECORD(TRACE_EV_QUEUE_SEND, RunningTask, queue_id);
+
+        memcpy(QueueSlot(queue, queue->head + queue->count), message, queue->message_size);
+        queue->count++;
+        return 0;
+    }
+
+    if (!blocking)
+    {
+        TRACE_VERBOSE("Queue %s is full\n", queue->name);
+        return -1;
+    }
+
+    // The receiver that makes room copies the message and wakes us
+    return WaitQueue(queue_id, &queue->send_head, &queue->send_tail, (void*)message);
+}
+
+static int GetMessage(int queue_id, void* message, int blocking)
+{
+    TQueue* queue;
+    int task;
+
+    queue = GetQueue(queue_id);
+    if (queue == NULL || message == NULL) return -1;
+
+    if (queue->count > 0)
+    {
+        TRACE_RECORD(TRACE_EV_QUEUE_RECEIVE, RunningTask, queue_id);
+
+        memcpy(message, QueueSlot(queue, queue->head), queue->message_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+
+        // Senders only wait while the queue is full, the first one gets the free slot
+        task = TakeWaiter(&queue->send_head, &queue->send_tail);
+
+        if (task != -1)
+        {
+            TRACE_SCHEDULE("Queue %s takes the message of task %s\n", queue->name, TaskQueue[task].name);
+
+            memcpy(QueueSlot(queue, queue->head + queue->count), TaskQueue[task].message,
+                   queue->message_size);
+            queue->count++;
+            WakeWaiter(task);
+
+            Dispatch();
+        }
+
+        return 0;
+    }
+
+    if (!blocking)
+    {
+        TRACE_VERBOSE("Queue %s is empty\n", queue->name);
+        return -1;
+    }
+
+    // The next sender copies its message into ours and wakes us
+    return WaitQueue(queue_id, &queue->receive_head, &queue->receive_tail, message);
+}
+
+int SendMessage(int queue_id, const void* message)
+{
+    return PutMessage(queue_id, message, 1);
+}
+
+int ReceiveMessage(int queue_id, void* message)
+{
+    return GetMessage(queue_id, message, 1);
+}
+
+int TrySendMessage(int queue_id, const void* message)
+{
+    return PutMessage(queue_id, message, 0);
+}
+
+int TryReceiveMessage(int queue_id, void* message)
+{
+    return GetMessage(queue_id, message, 0);
+}
+
+// Take a task that stops waiting without its message (ResumeTask) off
+// the wait list of its queue
+void StopWaitQueue(int task)
+{
+    TQueue* queue;
+
+    if (TaskQueue[task].waiting_queue == -1) return;
+
+    queue = &MessageQueue[TaskQueue[task].waiting_queue];
+
+    if (!RemoveWaiter(&queue->send_head, &queue->send_tail, task))
+        RemoveWaiter(&queue->receive_head, &queue->receive_tail, task);
+
+    TaskQueue.ref(task) = -1;
+    TaskQueue[task].waiting_queue = -1;
+}
@@ -3,83 +3,510 @@
 /*************************************/
 
 #include "sys.h"
+#include "trace.h"
 #include "rtos_api.h"
 #include <stdio.h>
 
-void GetResource(int priority, char* name)
+// Move a task to the head of the level of its new ceiling, a task that
+// is not ready only gets the new value
+static void SetCeiling(int task, int priority)
+{
+    if (TaskQueue.ceiling(task) == priority) return;
+
+    if (TaskQueue.state(task) == TASK_READY || TaskQueue.state(task) == TASK_RUNNING)
+    {
+        Unschedule(task);
+        TaskQueue.ceiling(task) = priority;
+        Schedule(task, INSERT_TO_HEAD);
+    }
+    else
+    {
+        TaskQueue.ceiling(task) = priority;
+    }
+}
+
+// Resources taken with GetResource(priority, name) use the ceiling too
+static bool HasCeiling(int handle)
+{
+    return !ResourceQueue[handle].persistent || ResourceQueue[handle].protocol == RESOURCE_CEILING;
+}
+
+// Push onto the resource stack of the task, a resource with a ceiling
+// also onto the stack of the system that keeps the SRP system ceiling
+static void PushResource(int task, int handle)
+{
+    ResourceQueue[handle].task = task;
+    ResourceQueue[handle].saved_ceiling = TaskQueue.ceiling(task);
+    ResourceQueue[handle].below = TaskQueue[task].resources;
+    TaskQueue[task].resources = handle;
+
+    if (!HasCeiling(handle)) return;
+
+    ResourceQueue[handle].saved_system_ceiling = SystemCeiling;
+    ResourceQueue[handle].system_below = CeilingTop;
+    CeilingTop = handle;
+
+    if (ResourceQueue[handle].priority > SystemCeiling)
+        SystemCeiling = ResourceQueue[handle].priority;
+}
+
+// Take a released resource off the stack of the system. Resources leave
+// it in the order they were taken, unless a task blocked while holding
+// one: then the saved ceilings above it are worked out again. The links
+// above it are turned around to walk them from the bottom, and turned
+// back on the way up.
+static void DropSystemCeiling(int handle)
+{
+    int cur, next, below, ceiling;
+
+    if (CeilingTop == handle)
+    {
+        SystemCeiling = ResourceQueue[handle].saved_system_ceiling;
+        CeilingTop = ResourceQueue[handle].system_below;
+        return;
+    }
+
+    below = -1;
+    for (cur = CeilingTop; cur != handle; cur = next)
+    {
+        next = ResourceQueue[cur].system_below;
+        ResourceQueue[cur].system_below = below;
+        below = cur;
+    }
+
+    // below is now the resource right above the released one
+    cur = below;
+    below = ResourceQueue[handle].system_below;
+    ceiling = ResourceQueue[handle].saved_system_ceiling;
+
+    while (cur != -1)
+    {
+        next = ResourceQueue[cur].system_below;
+        ResourceQueue[cur].system_below = below;
+        ResourceQueue[cur].saved_system_ceiling = ceiling;
+
+        if (ResourceQueue[cur].priority > ceiling)
+            ceiling = ResourceQueue[cur].priority;
+
+        below = cur;
+        cur = next;
+    }
+
+    SystemCeiling = ceiling;
+}
+
+// Raise the owner of a resource to the priority of a task blocked on it,
+// and the owner of whatever that owner is blocked on, and so on
+static void InheritPriority(int handle, int priority)
+{
+    int owner, above;
+
+    while (handle != -1)
+    {
+        owner = ResourceQueue[handle].task;
+        if (owner == -1) return;
+
+        // The resources taken after this one must not drop the owner
+        // below the inherited priority while this one is still held
+        for (above = TaskQueue[owner].resources; above != handle; above = ResourceQueue[above].below)
+        {
+            if (ResourceQueue[above].saved_ceiling < priority)
+                ResourceQueue[above].saved_ceiling = priority;
+        }
+
+        if (TaskQueue.ceiling(owner) >= priority) return;
+
+        TRACE_SCHEDULE("Task %s inherits priority %d\n", TaskQueue[owner].name, priority);
+        TRACE_RECORD(TRACE_EV_INHERIT, owner, priority);
+
+        SetCeiling(owner, priority);
+
+        handle = TaskQueue[owner].blocked_on;
+    }
+}
+
+// Hand a released resource to the highest priority task blocked on it
+static void GrantResource(int handle)
+{
+    int task, prev, best, best_prev, highest;
+
+    best = -1;
+    best_prev = -1;
+    prev = -1;
+
+    for (task = ResourceQueue[handle].waiting; task != -1; task = TaskQueue.ref(task))
+    {
+        if (best == -1 || TaskQueue.ceiling(task) > TaskQueue.ceiling(best))
+        {
+            best = task;
+            best_prev = prev;
+        }
+        prev = task;
+    }
+
+    if (best == -1) return;
+
+    if (best_prev == -1)
+        ResourceQueue[handle].waiting = TaskQueue.ref(best);
+    else
+        TaskQueue.ref(best_prev) = TaskQueue.ref(best);
+
+    TaskQueue[best].blocked_on = -1;
+    PushResource(best, handle);
+
+    TRACE_SCHEDULE("Resource %s passed to task %s\n", ResourceQueue[handle].name, TaskQueue[best].name);
+
+    TaskQueue.state(best) = TASK_READY;
+    Schedule(best, INSERT_TO_TAIL);
+
+    // The new owner inherits from the tasks that still wait
+    highest = -1;
+    for (task = ResourceQueue[handle].waiting; task != -1; task = TaskQueue.ref(task))
+    {
+        if (TaskQueue.ceiling(task) > highest)
+            highest = TaskQueue.ceiling(task);
+    }
+
+    if (highest != -1)
+        InheritPriority(handle, highest);
+}
+
+// Take the resource off the top of the stack of the task and give it back
+static void PopResource(int task, int handle)
+{
+    TaskQueue[task].resources = ResourceQueue[handle].below;
+
+    if (HasCeiling(handle))
+        DropSystemCeiling(handle);
+
+    if (ResourceQueue[handle].persistent)
+    {
+        ResourceQueue[handle].task = -1;
+
+        if (ResourceQueue[handle].waiting != -1)
+            GrantResource(handle);
+    }
+    else
+    {
+        ResourceQueue[handle].priority = FreeResource;
+        ResourceQueue[handle].task = -1;
+        FreeResource = handle;
+    }
+
+    // Jobs kept from starting by the old ceiling may run now (EDF)
+    StartParkedJobs();
+}
+
+int GetResource(int priority, char* name)
 {
     int free_occupy;
 
-    printf("GetResource %s\n", name);
+    TRACE_SCHEDULE("GetResource %s\n", name);
+
+    if (priority < 0 || priority >= MAX_PRIORITY)
+    {
+        TRACE_ERROR("ERROR: Invalid resource priority\n");
+        return -1;
+    }
+
+    if (RunningTask == -1)
+    {
+        TRACE_ERROR("ERROR: GetResource outside of a task\n");
+        return -1;
+    }
+
+    if (FreeResource == -1)
+    {
+        TRACE_ERROR("ERROR: No free resource slots\n");
+        return -1;
+    }
 
     free_occupy = FreeResource;
     FreeResource = ResourceQueue[FreeResource].priority;
 
     ResourceQueue[free_occupy].priority = priority;
-    ResourceQueue[free_occupy].task = RunningTask;
     ResourceQueue[free_occupy].name = name;
 
-    if (TaskQueue[RunningTask].ceiling_priority < priority)
+    PushResource(RunningTask, free_occupy);
+
+    TRACE_RECORD(TRACE_EV_RESOURCE_GET, RunningTask, priority);
+
+    if (TaskQueue.ceiling(RunningTask) < priority)
     {
-        TaskQueue[RunningTask].ceiling_priority = priority;
-        printf("Priority ceiling raised to %d for task %s\n",
+        SetCeiling(RunningTask, priority);
+
+        TRACE_SCHEDULE("Priority ceiling raised to %d for task %s\n",
                priority, TaskQueue[RunningTask].name);
     }
+
+    return free_occupy;
 }
 
-void ReleaseResource(int priority, char* name)
+// A resource that keeps its slot, with the ceiling or the inheritance
+// protocol. The priority is the ceiling, inheritance does not use it.
+int CreateResource(int priority, int protocol, char* name)
 {
-    int i, ResourceIndex;
+    int occupy;
 
-    printf("ReleaseResource %s\n", name);
+    if (priority < 0 || priority >= MAX_PRIORITY ||
+        (protocol != RESOURCE_CEILING && protocol != RESOURCE_INHERIT))
+    {
+        TRACE_ERROR("ERROR: Invalid resource priority or protocol\n");
+        return -1;
+    }
 
-    if (TaskQueue[RunningTask].ceiling_priority == priority)
+    if (FreeResource == -1)
     {
-        int res_priority, task_priority;
-        int our_task;
+        TRACE_ERROR("ERROR: No free resource slots\n");
+        return -1;
+    }
 
-        our_task = RunningTask;
-        task_priority = TaskQueue[RunningTask].priority;
+    occupy = FreeResource;
+    FreeResource = ResourceQueue[occupy].priority;
 
-        for (i = 0; i < MAX_RES; i++)
-        {
-            if (ResourceQueue[i].task != RunningTask) continue;
+    ResourceQueue[occupy].priority = priority;
+    ResourceQueue[occupy].protocol = protocol;
+    ResourceQueue[occupy].persistent = 1;
+    ResourceQueue[occupy].task = -1;
+    ResourceQueue[occupy].waiting = -1;
+    ResourceQueue[occupy].name = name;
 
-            res_priority = ResourceQueue[i].priority;
+    TRACE_VERBOSE("Resource %s created\n", name);
 
-            if (res_priority == priority && ResourceQueue[i].name == name)
-                ResourceIndex = i;
-            else
-            if (res_priority > task_priority)
-                task_priority = res_priority;
-        }
+    return occupy;
+}
+
+int GetResource(int handle)
+{
+    int our_task, owner;
+
+    our_task = RunningTask;
+
+    if (handle < 0 || handle >= MAX_RES || !ResourceQueue[handle].persistent || our_task == -1)
+    {
+        TRACE_ERROR("ERROR: Invalid resource handle\n");
+        return -1;
+    }
+
+    TRACE_SCHEDULE("GetResource %s\n", ResourceQueue[handle].name);
+
+    owner = ResourceQueue[handle].task;
 
-        TaskQueue[RunningTask].ceiling_priority = task_priority;
+    if (owner == our_task)
+    {
+        TRACE_ERROR("ERROR: Task %s already holds resource %s\n",
+                    TaskQueue[our_task].name, ResourceQueue[handle].name);
+        return -1;
+    }
 
-        RunningTask = TaskQueue[RunningTask].ref;
-        Schedule(our_task, INSERT_TO_HEAD);
+    if (owner == -1)
+    {
+        PushResource(our_task, handle);
 
-        ResourceQueue[ResourceIndex].priority = FreeResource;
-        ResourceQueue[ResourceIndex].task = -1;
-        FreeResource = ResourceIndex;
+        TRACE_RECORD(TRACE_EV_RESOURCE_GET, our_task, ResourceQueue[handle].priority);
 
-        if (our_task != RunningTask && RunningTask != -1)
+        if (ResourceQueue[handle].protocol == RESOURCE_CEILING &&
+            TaskQueue.ceiling(our_task) < ResourceQueue[handle].priority)
         {
-            Dispatch(our_task);
+            SetCeiling(our_task, ResourceQueue[handle].priority);
+
+            TRACE_SCHEDULE("Priority ceiling raised to %d for task %s\n",
+                   ResourceQueue[handle].priority, TaskQueue[our_task].name);
         }
+
+        return handle;
     }
-    else
+
+    // The ceiling protocol never finds its resource taken when the
+    // ceiling is right
+    if (ResourceQueue[handle].protocol == RESOURCE_CEILING)
+    {
+        TRACE_ERROR("ERROR: Ceiling of resource %s is below task %s\n",
+                    ResourceQueue[handle].name, TaskQueue[our_task].name);
+        return -1;
+    }
+
+    TRACE_SCHEDULE("Task %s blocked on resource %s held by %s\n", TaskQueue[our_task].name,
+                   ResourceQueue[handle].name, TaskQueue[owner].name);
+    TRACE_RECORD(TRACE_EV_RESOURCE_BLOCK, our_task, owner);
+
+    TaskQueue.state(our_task) = TASK_WAITING;
+    TaskQueue[our_task].blocked_on = handle;
+    Unschedule(our_task);
+
+    TaskQueue.ref(our_task) = ResourceQueue[handle].waiting;
+    ResourceQueue[handle].waiting = our_task;
+
+    InheritPriority(handle, TaskQueue.ceiling(our_task));
+
+    // Continues here once the resource was passed to us
+    Dispatch();
+
+    return handle;
+}
+
+void ReleaseResource(int handle)
+{
+    int our_task, restore;
+
+    our_task = RunningTask;
+
+    if (handle < 0 || handle >= MAX_RES || our_task == -1 ||
+        ResourceQueue[handle].task != our_task)
+    {
+        TRACE_ERROR("ERROR: Resource is not held by the running task\n");
+        return;
+    }
+
+    // Resources are released in the reverse order they were taken
+    if (TaskQueue[our_task].resources != handle)
+    {
+        TRACE_ERROR("ERROR: Resource %s is not the last one taken by task %s\n",
+                    ResourceQueue[handle].name, TaskQueue[our_task].name);
+        return;
+    }
+
+    TRACE_SCHEDULE("ReleaseResource %s\n", ResourceQueue[handle].name);
+    TRACE_RECORD(TRACE_EV_RESOURCE_RELEASE, our_task, ResourceQueue[handle].priority);
+
+    restore = ResourceQueue[handle].saved_ceiling;
+
+    PopResource(our_task, handle);
+
+    SetCeiling(our_task, restore);
+
+    Dispatch();
+}
+
+void ReleaseResource(int priority, char* name)
+{
+    int handle;
+
+    handle = (RunningTask == -1) ? -1 : TaskQueue[RunningTask].resources;
+
+    if (handle == -1 || ResourceQueue[handle].priority != priority ||
+        ResourceQueue[handle].name != name)
+    {
+        TRACE_ERROR("ERROR: Resource %s is not the last one taken\n", name);
+        return;
+    }
+
+    ReleaseResource(handle);
+}
+
+// Give back what a finished task still holds
+void FreeResources(int task)
+{
+    int handle;
+
+    while ((handle = TaskQueue[task].resources) != -1)
+    {
+        TRACE_ERROR("ERROR: Task %s ends holding resource %s\n",
+                    TaskQueue[task].name, ResourceQueue[handle].name);
+
+        PopResource(task, handle);
+    }
+
+    TaskQueue.ceiling(task) = TaskQueue[task].priority;
+}
+
+// Priority a held resource raises its owner to: its ceiling, or the
+// highest task waiting for an inheritance resource
+static int HeldCeiling(int handle)
+{
+    int task, highest;
+
+    if (HasCeiling(handle)) return ResourceQueue[handle].priority;
+
+    highest = -1;
+    for (task = ResourceQueue[handle].waiting; task != -1; task = TaskQueue.ref(task))
+    {
+        if (TaskQueue.ceiling(task) > highest)
+            highest = TaskQueue.ceiling(task);
+    }
+
+    return highest;
+}
+
+// Work out the ceiling of an owner again from its priority and the
+// resources it holds, once a task left one of its wait lists. The stack
+// is turned around like the system stack in DropSystemCeiling() to
+// rebuild the saved ceilings from the bottom. An owner that waits in
+// turn passed what it inherited on, so the chain is followed until a
+// ceiling stays the same.
+static void RecomputeCeiling(int owner)
+{
+    int handle, next, below, ceiling, held;
+
+    while (owner != -1)
     {
-        ResourceIndex = 0;
-        while (ResourceQueue[ResourceIndex].task != RunningTask ||
-               ResourceQueue[ResourceIndex].priority != priority ||
-               ResourceQueue[ResourceIndex].name != name)
+        below = -1;
+        for (handle = TaskQueue[owner].resources; handle != -1; handle = next)
         {
-            ResourceIndex++;
+            next = ResourceQueue[handle].below;
+            ResourceQueue[handle].below = below;
+            below = handle;
         }
 
-        ResourceQueue[ResourceIndex].priority = FreeResource;
-        ResourceQueue[ResourceIndex].task = -1;
-        FreeResource = ResourceIndex;
+        // below is now the first resource the owner took
+        handle = below;
+        below = -1;
+        ceiling = TaskQueue[owner].priority;
+
+        while (handle != -1)
+        {
+            next = ResourceQueue[handle].below;
+            ResourceQueue[handle].below = below;
+            ResourceQueue[handle].saved_ceiling = ceiling;
+
+            held = HeldCeiling(handle);
+            if (held > ceiling)
+                ceiling = held;
+
+            below = handle;
+            handle = next;
+        }
+
+        if (TaskQueue.ceiling(owner) == ceiling) return;
+
+        TRACE_SCHEDULE("Task %s drops to priority %d\n", TaskQueue[owner].name, ceiling);
+
+        SetCeiling(owner, ceiling);
+
+        handle = TaskQueue[owner].blocked_on;
+        owner = (handle == -1) ? -1 : ResourceQueue[handle].task;
     }
-}
\ No newline at end of file
+}
+
+// Take a task that stops waiting without the resource (ResumeTask,
+// AbortTask) off the wait list, the owner gives up what it inherited
+// from the task
+void StopWaitResource(int task)
+{
+    int handle, cur, prev;
+
+    handle = TaskQueue[task].blocked_on;
+    if (handle == -1) return;
+
+    cur = ResourceQueue[handle].waiting;
+    prev = -1;
+
+    while (cur != -1 && cur != task)
+    {
+        prev = cur;
+        cur = TaskQueue.ref(cur);
+    }
+
+    if (cur != -1)
+    {
+        if (prev == -1)
+            ResourceQueue[handle].waiting = TaskQueue.ref(task);
+        else
+            TaskQueue.ref(prev) = TaskQueue.ref(task);
+    }
+
+    TaskQueue.ref(task) = -1;
+    TaskQueue[task].blocked_on = -1;
+
+    RecomputeCeiling(ResourceQueue[handle].task);
+}
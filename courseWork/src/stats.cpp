@@ -0,0 +1,194 @@
+/*************************************/
+/*              stats.cpp              */
+/*************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <bit>
+
+#include "sys.h"
+#include "trace.h"
+#include "rtos_api.h"
+
+// Response time and start latency of every job, kept per task name so
+// the jobs of a periodic task, which each get a slot of their own, add
+// up to one task. The histograms have log2 buckets, their memory is
+// fixed however long the system runs.
+
+static int StatsBucket(int ticks)
+{
+    int bucket;
+
+    if (ticks <= 0) return 0;
+
+    bucket = std::bit_width((unsigned int)ticks);
+
+    return (bucket < STATS_BUCKETS) ? bucket : STATS_BUCKETS - 1;
+}
+
+// Record of a task name, created on its first activation
+static int LookupTaskStats(const char* name)
+{
+    TStatsRecord* record;
+    int i;
+
+    for (i = 0; i < TaskStatsCount; i++)
+    {
+        if (TaskStats[i].name == name || strcmp(TaskStats[i].name, name) == 0)
+            return i;
+    }
+
+    if (TaskStatsCount >= MAX_TASK_STATS)
+    {
+        TRACE_VERBOSE("No room for the statistics of task %s\n", name);
+        return -1;
+    }
+
+    record = &TaskStats[TaskStatsCount];
+
+    memset(&record->stats, 0, sizeof(record->stats));
+    record->name = name;
+    record->stats.last_release = -1;
+    record->stats.last_start = -1;
+    record->stats.last_completion = -1;
+    record->stats.min_response = INT_MAX;
+
+    return TaskStatsCount++;
+}
+
+// Record of a task name. Tasks pass their name as the same literal on
+// every activation, so the pointer is looked up in TaskStatsNames and
+// only its first use compares the strings. Alarms and the periodic jobs
+// of a task keep the entry they got once.
+int FindTaskStats(const char* name)
+{
+    unsigned slot, probe;
+
+    if (name == NULL) return -1;
+
+    slot = (unsigned)(((uintptr_t)name >> 3) * 2654435761u) % STATS_NAME_SLOTS;
+
+    for (probe = 0; probe < STATS_NAME_SLOTS; probe++)
+    {
+        if (TaskStatsNames[slot].name == name)
+            return TaskStatsNames[slot].record;
+
+        if (TaskStatsNames[slot].name == NULL)
+        {
+            TaskStatsNames[slot].name = name;
+            TaskStatsNames[slot].record = LookupTaskStats(name);
+            return TaskStatsNames[slot].record;
+        }
+
+        slot = (slot + 1) % STATS_NAME_SLOTS;
+    }
+
+    // Every slot holds another pointer
+    return LookupTaskStats(name);
+}
+
+// A job of the task completed, a job that never ran is not counted
+void RecordJob(int task)
+{
+    TTaskStats* stats;
+    int response, latency;
+
+    if (TaskQueue[task].stats == -1 || TaskQueue[task].start == -1) return;
+
+    stats = &TaskStats[TaskQueue[task].stats].stats;
+
+    response = SystemTick - TaskQueue[task].last_run;
+    latency = TaskQueue[task].start - TaskQueue[task].last_run;
+
+    stats->jobs++;
+    stats->last_release = TaskQueue[task].last_run;
+    stats->last_start = TaskQueue[task].start;
+    stats->last_completion = SystemTick;
+
+    if (response < stats->min_response)
+        stats->min_response = response;
+    if (response > stats->max_response)
+        stats->max_response = response;
+    stats->total_response += response;
+
+    if (latency > stats->max_latency)
+        stats->max_latency = latency;
+
+    stats->response[StatsBucket(response)]++;
+    stats->latency[StatsBucket(latency)]++;
+
+    // A released job is a new job even if the slot is reused
+    TaskQueue[task].start = -1;
+}
+
+int GetTaskStats(const char* name, TTaskStats* stats)
+{
+    int i;
+
+    if (name == NULL || stats == NULL) return -1;
+
+    for (i = 0; i < TaskStatsCount; i++)
+    {
+        if (strcmp(TaskStats[i].name, name) == 0)
+        {
+            *stats = TaskStats[i].stats;
+            if (stats->jobs == 0)
+                stats->min_response = 0;
+            return 0;
+        }
+    }
+
+    TRACE_VERBOSE("No statistics for task %s\n", name);
+    return -1;
+}
+
+static void DumpHistogram(FILE* file, const char* title, const int* buckets)
+{
+    int i;
+
+    fprintf(file, "    %-9s", title);
+
+    for (i = 0; i < STATS_BUCKETS; i++)
+    {
+        if (buckets[i] == 0) continue;
+
+        if (i == 0)
+            fprintf(file, " 0:%d", buckets[i]);
+        else if (i == STATS_BUCKETS - 1)
+            fprintf(file, " %d+:%d", 1 << (i - 1), buckets[i]);
+        else
+            fprintf(file, " %d-%d:%d", 1 << (i - 1), (1 << i) - 1, buckets[i]);
+    }
+
+    fprintf(file, "\n");
+}
+
+void DumpTaskStats(FILE* file)
+{
+    TTaskStats* stats;
+    int i;
+
+    if (file == NULL) return;
+
+    for (i = 0; i < TaskStatsCount; i++)
+    {
+        stats = &TaskStats[i].stats;
+
+        if (stats->jobs == 0) continue;
+
+        fprintf(file, "Task %s: %d jobs, response min %d avg %.1f max %d, latency max %d, "
+                "%d misses up to %d ticks late\n",
+                TaskStats[i].name, stats->jobs, stats->min_response,
+                (double)stats->total_response / stats->jobs, stats->max_response,
+                stats->max_latency, stats->misses, stats->max_lateness);
+        DumpHistogram(file, "response", stats->response);
+        DumpHistogram(file, "latency", stats->latency);
+    }
+}
+
+void SetStatsOutput(FILE* file)
+{
+    StatsOutput = file;
+}
@@ -2,63 +2,268 @@
 /*          task.cpp              */
 /*********************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <bit>
 
 #include "sys.h"
+#include "trace.h"
 #include "rtos_api.h"
 
-extern int SystemTick;
-extern int TaskLastRun[MAX_TASK];
+
+static_assert(MAX_PRIORITY <= 32, "ReadyMap holds one bit per priority level");
+
+// Give every existing slot its initial state and put it on the free list
+void InitTasks(void)
+{
+    int i;
+
+    for (i = 0; i < TaskCount; i++)
+    {
+        TaskQueue.ref(i) = (i + 1 < TaskCount) ? i + 1 : -1;
+        TaskQueue.prev(i) = TASK_UNLINKED;
+        TaskQueue.state(i) = TASK_READY;
+        TaskQueue[i].waiting_event = -1;
+        TaskQueue[i].coroutine = NULL;
+        TaskQueue[i].blocked_on = -1;
+        TaskQueue[i].waiting_queue = -1;
+        TaskQueue[i].inbox_head = -1;
+        TaskQueue[i].inbox_tail = -1;
+        TaskQueue[i].period = 0;        // No periodic behavior by default
+        TaskQueue[i].deadline = 0;      // No deadline by default
+        TaskQueue[i].last_run = 0;      // Not run yet
+        TaskQueue[i].start = -1;
+        TaskQueue[i].stats = -1;
+        TaskQueue[i].job = -1;
+        TaskQueue[i].late = 0;
+        TaskQueue[i].wcet = 0;
+        TaskQueue[i].response_bound = -1;
+        TaskQueue[i].in_heap = 0;
+        TIMER(WAKEUP_TIMER(i)).slot = -1;
+        TIMER(RELEASE_TIMER(i)).slot = -1;
+    }
+
+    FreeTask = (TaskCount > 0) ? 0 : -1;
+}
+
+// Add a chunk of slots to the pool, -1 once MAX_TASK slots exist
+static int GrowTasks(void)
+{
+    TTaskChunk* chunk;
+    int first, count, i;
+
+    first = TaskCount;
+    if (first >= MAX_TASK) return -1;
+
+    count = MAX_TASK - first;
+    if (count > TASK_CHUNK_SIZE) count = TASK_CHUNK_SIZE;
+
+    chunk = (TTaskChunk*)calloc(1, sizeof(TTaskChunk));
+    if (chunk == NULL) return -1;
+
+    TaskQueue.chunks[first / TASK_CHUNK_SIZE] = chunk;
+    TaskCount = first + count;
+
+    for (i = first; i < first + count; i++)
+    {
+        TaskQueue.ref(i) = (i + 1 < first + count) ? i + 1 : FreeTask;
+        TaskQueue.prev(i) = TASK_UNLINKED;
+        TaskQueue.state(i) = TASK_READY;
+        TaskQueue[i].waiting_event = -1;
+        TaskQueue[i].blocked_on = -1;
+        TaskQueue[i].waiting_queue = -1;
+        TaskQueue[i].inbox_head = -1;
+        TaskQueue[i].inbox_tail = -1;
+        TIMER(WAKEUP_TIMER(i)).slot = -1;
+        TIMER(RELEASE_TIMER(i)).slot = -1;
+        TaskQueue[i].fresh = 1;
+    }
+
+    FreeTask = first;
+
+    TRACE_VERBOSE("Task pool grown to %d slots\n", TaskCount);
+
+    return 0;
+}
+
+// Take a slot from the free list, the pool grows when it is empty
+static int AllocTask(void)
+{
+    int task;
+
+    if (FreeTask == -1 && GrowTasks() == -1)
+    {
+        TRACE_ERROR("ERROR: No free task slots\n");
+        return -1;
+    }
+
+    task = FreeTask;
+    FreeTask = TaskQueue.ref(task);
+
+    return task;
+}
+
+// Return a slot to the free list, handles to its old task become stale
+static void FreeTaskSlot(int task)
+{
+    TaskQueue[task].generation = (TaskQueue[task].generation + 1) & TASK_GENERATION_MASK;
+    TaskQueue.ref(task) = FreeTask;
+    FreeTask = task;
+}
+
+// Release the chunks before the kernel goes away
+void FreeTaskPool(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_TASK_CHUNKS; i++)
+    {
+        free(TaskQueue.chunks[i]);
+        TaskQueue.chunks[i] = NULL;
+    }
+
+    TaskCount = 0;
+    FreeTask = -1;
+}
+
+int TaskHandle(int task)
+{
+    return TASK_HANDLE(task, TaskQueue[task].generation);
+}
+
+// Slot of a task handle, -1 if the handle is invalid or its task ended
+int TaskIndex(int handle)
+{
+    int task;
+
+    if (handle < 0) return -1;
+
+    task = handle & ((1 << TASK_INDEX_BITS) - 1);
+
+    if (task >= TaskCount || TaskHandle(task) != handle) return -1;
+
+    return task;
+}
+
+// Handle of the running task, -1 outside of a task
+int GetTaskID(void)
+{
+    return (RunningTask == -1) ? -1 : TaskHandle(RunningTask);
+}
 
 void ActivateTask(TTaskCall entry, int priority, char* name)
 {
-    int task, occupy;
+    StartTask(entry, NULL, priority, name, FindTaskStats(name));
+}
+
+// Activate a stackful task (entry) or a coroutine task (coroutine frame).
+// stats is the TaskStats entry of the name, looked up once by callers
+// that activate the same task again and again.
+int StartTask(void (*entry)(void), void* coroutine, int priority, char* name, int stats)
+{
+    int occupy;
 
-    printf("ActivateTask %s\n", name);
+    TRACE_SCHEDULE("ActivateTask %s\n", name);
 
-    task = RunningTask;
+    if (priority < 0 || priority >= MAX_PRIORITY)
+    {
+        TRACE_ERROR("ERROR: Invalid task priority\n");
+        return -1;
+    }
 
-    occupy = FreeTask;
-    FreeTask = TaskQueue[occupy].ref;
+    occupy = AllocTask();
+    if (occupy == -1) return -1;
 
     TaskQueue[occupy].priority = priority;
-    TaskQueue[occupy].ceiling_priority = priority;
+    TaskQueue.ceiling(occupy) = priority;
     TaskQueue[occupy].name = name;
     TaskQueue[occupy].entry = entry;
-    TaskQueue[occupy].state = TASK_READY;
+    TaskQueue[occupy].coroutine = coroutine;
+    TaskQueue.state(occupy) = TASK_READY;
     TaskQueue[occupy].waiting_event = -1;
-
-    TaskLastRun[occupy] = SystemTick;
+    TaskQueue[occupy].events_set = 0;
+    TaskQueue[occupy].events_waited = 0;
+    TaskQueue[occupy].resources = -1;
+    TaskQueue[occupy].blocked_on = -1;
+    TaskQueue[occupy].waiting_queue = -1;
+    TaskQueue[occupy].inbox_head = -1;
+    TaskQueue[occupy].inbox_tail = -1;
+
+    TaskQueue[occupy].last_run = SystemTick;
+    TaskQueue[occupy].start = -1;
+    TaskQueue[occupy].stats = stats;
+    TaskQueue[occupy].job = -1;
+    TaskQueue[occupy].late = 0;
+    TaskQueue[occupy].deadline = 0;
+    TaskQueue[occupy].wcet = 0;
+    TaskQueue[occupy].response_bound = -1;
+
+    ResetContext(occupy);
+
+    TRACE_RECORD(TRACE_EV_ACTIVATE, occupy, priority);
 
     Schedule(occupy, INSERT_TO_TAIL);
 
-    if (task != RunningTask)
+    Dispatch();
+
+    TRACE_VERBOSE("End of ActivateTask %s\n", name);
+
+    return occupy;
+}
+
+void TerminateTask(void)
+{
+    if (IS_COTASK(RunningTask))
+    {
+        TRACE_ERROR("ERROR: A coroutine task ends with co_return\n");
+        return;
+    }
+
+    EndTask(RunningTask);
+
+    if (RunningTask == -1)
     {
-        Dispatch(task);
+        TRACE_SCHEDULE("No more tasks, entering idle loop\n");
     }
 
-    printf("End of ActivateTask %s\n", name);
+    // Never returns, the context of this task is abandoned
+    Dispatch();
 }
 
-void TerminateTask(void)
+// Take a finished task out of the scheduler and free its slot
+void EndTask(int task)
 {
-    int task;
+    TRACE_SCHEDULE("TerminateTask %s\n", TaskQueue[task].name);
+    TRACE_RECORD(TRACE_EV_TERMINATE, task, 0);
 
-    task = RunningTask;
+    Unschedule(task);
 
-    printf("TerminateTask %s\n", TaskQueue[task].name);
+    AccountJob(task);
 
-    RunningTask = TaskQueue[task].ref;
+    FreeResources(task);
 
-    TaskQueue[task].ref = FreeTask;
-    FreeTask = task;
+    FreeInbox(task);
 
-    if (RunningTask == -1)
+    TaskQueue.state(task) = TASK_SUSPENDED;
+
+    // A periodic task keeps its slot, its releases are activated from it
+    if (TaskQueue[task].period <= 0)
     {
-        printf("No more tasks, entering idle loop\n");
-        IdleLoop();
+        FreeTaskSlot(task);
     }
+}
 
-    printf("End of TerminateTask %s\n", TaskQueue[task].name);
+// End a task that is not the active context wherever it waits, its
+// context is abandoned like the one of a task that terminates
+void AbortTask(int task)
+{
+    StopTimer(WAKEUP_TIMER(task));
+    StopWaitEvent(task);
+    StopWaitResource(task);
+    StopWaitQueue(task);
+    TaskQueue[task].events_waited = 0;
+
+    EndTask(task);
 }
 
 // Create a task but don't activate it (POSIX-like)
@@ -66,89 +271,135 @@ int CreateTask(TTaskCall entry, int priority, char* name)
 {
     int occupy;
 
-    // Get a free slot
-    if (FreeTask == -1)
+    if (entry == NULL || priority < 0 || priority >= MAX_PRIORITY)
     {
-        printf("ERROR: No free task slots\n");
+        TRACE_ERROR("ERROR: Invalid task entry or priority\n");
         return -1;
     }
 
-    occupy = FreeTask;
-    FreeTask = TaskQueue[occupy].ref;
+    // Get a free slot
+    occupy = AllocTask();
+    if (occupy == -1) return -1;
 
     TaskQueue[occupy].priority = priority;
-    TaskQueue[occupy].ceiling_priority = priority;
+    TaskQueue.ceiling(occupy) = priority;
     TaskQueue[occupy].name = name;
     TaskQueue[occupy].entry = entry;
-    TaskQueue[occupy].state = TASK_READY;
+    TaskQueue[occupy].coroutine = NULL;
+    TaskQueue.state(occupy) = TASK_SUSPENDED;
     TaskQueue[occupy].waiting_event = -1;
-    TaskQueue[occupy].ref = -1;
-
-    printf("Task %s created with priority %d\n", name, priority);
-
-    return occupy;
+    TaskQueue[occupy].events_set = 0;
+    TaskQueue[occupy].events_waited = 0;
+    TaskQueue[occupy].resources = -1;
+    TaskQueue[occupy].blocked_on = -1;
+    TaskQueue[occupy].waiting_queue = -1;
+    TaskQueue[occupy].inbox_head = -1;
+    TaskQueue[occupy].inbox_tail = -1;
+    TaskQueue.ref(occupy) = -1;
+
+    TaskQueue[occupy].last_run = SystemTick;
+    TaskQueue[occupy].start = -1;
+    TaskQueue[occupy].stats = FindTaskStats(name);
+    TaskQueue[occupy].job = -1;
+    TaskQueue[occupy].late = 0;
+    TaskQueue[occupy].deadline = 0;
+    TaskQueue[occupy].wcet = 0;
+    TaskQueue[occupy].response_bound = -1;
+
+    ResetContext(occupy);
+
+    TRACE_SCHEDULE("Task %s created with priority %d\n", name, priority);
+
+    return TaskHandle(occupy);
 }
 
 // Suspend a task
 int SuspendTask(int task_id)
 {
-    if (task_id < 0 || task_id >= MAX_TASK)
+    int task = TaskIndex(task_id);
+
+    if (task == -1)
     {
-        printf("ERROR: Invalid task ID\n");
+        TRACE_ERROR("ERROR: Invalid task ID\n");
         return -1;
     }
 
-    TaskQueue[task_id].state = TASK_WAITING;
+    if (TaskQueue.state(task) == TASK_READY ||
+        TaskQueue.state(task) == TASK_RUNNING)
+    {
+        Unschedule(task);
+    }
+
+    TaskQueue.state(task) = TASK_WAITING;
 
-    if (task_id == RunningTask)
+    TRACE_SCHEDULE("Task %s suspended\n", TaskQueue[task].name);
+
+    // A task suspending itself continues here once it is resumed
+    Dispatch();
+
+    return 0;
+}
+
+// A periodic task is not released again and gives up its slot as well,
+// the jobs it released already run on
+int DeleteTask(int task_id)
+{
+    int task = TaskIndex(task_id);
+
+    if (task == -1 || task == ActiveContext || IS_COTASK(task))
     {
-        int next_task = TaskQueue[task_id].ref;
-        RunningTask = next_task;
-        if (next_task != -1)
-        {
-            Dispatch(task_id);
-        }
-        else
-        {
-            IdleLoop();
-        }
+        TRACE_ERROR("ERROR: Invalid task ID\n");
+        return -1;
     }
 
-    printf("Task %s suspended\n", TaskQueue[task_id].name);
+    TaskQueue[task].period = 0;
+    StopTimer(RELEASE_TIMER(task));
+
+    AbortTask(task);
+
+    // The owner of a resource it waited for may have dropped below a
+    // ready task
+    Dispatch();
 
     return 0;
 }
 
 int ResumeTask(int task_id)
 {
-    if (task_id < 0 || task_id >= MAX_TASK)
+    int task = TaskIndex(task_id);
+
+    if (task == -1)
     {
-        printf("ERROR: Invalid task ID\n");
+        TRACE_ERROR("ERROR: Invalid task ID\n");
         return -1;
     }
 
-    if (TaskQueue[task_id].state == TASK_SUSPENDED ||
-        TaskQueue[task_id].state == TASK_WAITING ||
-        TaskQueue[task_id].ref == -1)
+    if (TaskQueue.state(task) == TASK_SUSPENDED ||
+        TaskQueue.state(task) == TASK_WAITING)
     {
-        TaskQueue[task_id].state = TASK_READY;
-
-        Schedule(task_id, INSERT_TO_TAIL);
-
-        if (RunningTask != -1 &&
-            TaskQueue[task_id].ceiling_priority > TaskQueue[RunningTask].ceiling_priority)
+        StopTimer(WAKEUP_TIMER(task));
+        StopWaitEvent(task);
+        StopWaitResource(task);
+        StopWaitQueue(task);
+        TaskQueue[task].events_waited = 0;
+
+        // A suspended task has no context left, it starts from the beginning
+        if (TaskQueue.state(task) == TASK_SUSPENDED)
         {
-            int prev_running = RunningTask;
-            RunningTask = task_id;
-            Dispatch(prev_running);
-        }
-        else if (RunningTask == -1)
-        {
-            RunningTask = task_id;
-            Dispatch(-1);
+            ResetContext(task);
+            TaskQueue[task].last_run = SystemTick;
+            TaskQueue[task].start = -1;
+            TaskQueue[task].late = 0;
         }
 
-        printf("Task %s resumed\n", TaskQueue[task_id].name);
+        TaskQueue.state(task) = TASK_READY;
+
+        Schedule(task, INSERT_TO_TAIL);
+
+        TRACE_SCHEDULE("Task %s resumed\n", TaskQueue[task].name);
+
+        Dispatch();
+
         return 0;
     }
 
@@ -158,84 +409,330 @@ int ResumeTask(int task_id)
 // Delay a task for a number of ticks
 void DelayTask(int ticks)
 {
-    if (RunningTask == -1) return;
+    if (RunningTask == -1 || ticks <= 0) return;
 
-    printf("Delaying task %s for %d ticks\n", TaskQueue[RunningTask].name, ticks);
+    TRACE_SCHEDULE("Delaying task %s for %d ticks\n", TaskQueue[RunningTask].name, ticks);
 
     int current_task = RunningTask;
 
-    TaskQueue[current_task].state = TASK_WAITING;
+    TaskQueue.state(current_task) = TASK_WAITING;
 
     int wake_time = SystemTick + ticks;
-    RunningTask = TaskQueue[current_task].ref;
+    Unschedule(current_task);
 
-    if (RunningTask == -1)
+    StartTimer(WAKEUP_TIMER(current_task), wake_time);
+    TRACE_RECORD(TRACE_EV_DELAY, current_task, wake_time);
+
+    // Continues here once the wakeup timer made us ready again
+    Dispatch();
+
+}
+
+// EDF heap order: earlier deadline first, then the order the jobs became
+// ready. The sequences are compared by difference so they may wrap.
+static bool EdfBefore(const TEdfEntry& a, const TEdfEntry& b)
+{
+    if (a.deadline != b.deadline) return a.deadline < b.deadline;
+
+    return (int)((unsigned int)a.sequence - (unsigned int)b.sequence) < 0;
+}
+
+static void EdfPlace(int position, const TEdfEntry& entry)
+{
+    EdfHeap[position] = entry;
+    TaskQueue.ref(entry.task) = position;
+}
+
+static void EdfSiftUp(int position)
+{
+    TEdfEntry entry = EdfHeap[position];
+    int parent;
+
+    while (position > 0)
     {
-        IdleLoop();
+        parent = (position - 1) / 2;
+        if (!EdfBefore(entry, EdfHeap[parent])) break;
+
+        EdfPlace(position, EdfHeap[parent]);
+        position = parent;
     }
-    else
+
+    EdfPlace(position, entry);
+}
+
+static void EdfSiftDown(int position)
+{
+    TEdfEntry entry = EdfHeap[position];
+    int child;
+
+    while ((child = 2 * position + 1) < EdfCount)
     {
-        Dispatch(current_task);
+        if (child + 1 < EdfCount && EdfBefore(EdfHeap[child + 1], EdfHeap[child]))
+            child++;
+
+        if (!EdfBefore(EdfHeap[child], entry)) break;
+
+        EdfPlace(position, EdfHeap[child]);
+        position = child;
     }
 
+    EdfPlace(position, entry);
 }
 
-void Schedule(int task, int mode)
+static void EdfInsert(int task, int mode)
 {
-    int cur, prev;
-    int priority;
+    TEdfEntry entry;
 
-    printf("Schedule %s\n", TaskQueue[task].name);
+    entry.deadline = (TaskQueue[task].deadline > 0) ? TaskQueue[task].last_run + TaskQueue[task].deadline : INT_MAX;
+    entry.sequence = (mode == INSERT_TO_TAIL) ? EdfTailSequence++ : --EdfHeadSequence;
+    entry.task = task;
 
-    cur = RunningTask;
-    prev = -1;
+    TaskQueue[task].in_heap = 1;
 
-    priority = TaskQueue[task].ceiling_priority;
+    EdfHeap[EdfCount] = entry;
+    EdfSiftUp(EdfCount++);
+}
 
-    // RMA scheduling: higher priority tasks get scheduled first
-    while (cur != -1 && TaskQueue[cur].ceiling_priority > priority)
-    {
-        prev = cur;
-        cur = TaskQueue[cur].ref;
-    }
+static void EdfRemove(int task)
+{
+    int position = TaskQueue.ref(task);
+
+    TaskQueue[task].in_heap = 0;
+    TaskQueue.ref(task) = -1;
+
+    if (--EdfCount == position) return;
+
+    // The last entry fills the hole, it may belong above or below it
+    EdfPlace(position, EdfHeap[EdfCount]);
 
+    if (position > 0 && EdfBefore(EdfHeap[position], EdfHeap[(position - 1) / 2]))
+        EdfSiftUp(position);
+    else
+        EdfSiftDown(position);
+}
+
+// Append a task to the FIFO of its level
+static void LevelInsert(int task, int priority, int mode)
+{
     if (mode == INSERT_TO_TAIL)
     {
-        while (cur != -1 && TaskQueue[cur].ceiling_priority == priority)
-        {
-            prev = cur;
-            cur = TaskQueue[cur].ref;
-        }
+        TaskQueue.ref(task) = -1;
+        TaskQueue.prev(task) = ReadyTail[priority];
+
+        if (ReadyHead[priority] == -1)
+            ReadyHead[priority] = task;
+        else
+            TaskQueue.ref(ReadyTail[priority]) = task;
+
+        ReadyTail[priority] = task;
+    }
+    else
+    {
+        TaskQueue.ref(task) = ReadyHead[priority];
+        TaskQueue.prev(task) = -1;
+
+        if (ReadyHead[priority] == -1)
+            ReadyTail[priority] = task;
+        else
+            TaskQueue.prev(ReadyHead[priority]) = task;
+
+        ReadyHead[priority] = task;
     }
 
-    TaskQueue[task].ref = cur;
+    ReadyMap |= 1u << priority;
+}
+
+void Schedule(int task, int mode)
+{
+    int priority;
+
+    TRACE_SCHEDULE("Schedule %s\n", TaskQueue[task].name);
+
+    priority = TaskQueue.ceiling(task);
+
+    // RMA scheduling: each priority level is a FIFO, the highest
+    // non-empty level provides the running task. Under EDF a job that
+    // has not started yet waits in its level while it is below the
+    // system ceiling (SRP), every other job goes into the heap.
+    if (SchedulingPolicy == POLICY_EDF && (TaskQueue[task].start != -1 || priority > SystemCeiling))
+        EdfInsert(task, mode);
+    else
+        LevelInsert(task, priority, mode);
+
+    RunningTask = HighestReady();
+
+    TRACE_RECORD(TRACE_EV_SCHEDULE, task, RunningTask);
+
+    TRACE_VERBOSE("End of Schedule %s\n", TaskQueue[task].name);
+}
+
+// Take a task out of the FIFO of its level
+static void LevelRemove(int task)
+{
+    int prev, next;
+    int priority;
+
+    prev = TaskQueue.prev(task);
+    priority = TaskQueue.ceiling(task);
+    next = TaskQueue.ref(task);
 
     if (prev == -1)
-        RunningTask = task;
+        ReadyHead[priority] = next;
+    else
+        TaskQueue.ref(prev) = next;
+
+    if (next == -1)
+        ReadyTail[priority] = prev;
     else
-        TaskQueue[prev].ref = task;
+        TaskQueue.prev(next) = prev;
+
+    if (ReadyHead[priority] == -1)
+        ReadyMap &= ~(1u << priority);
+
+    TaskQueue.ref(task) = -1;
+    TaskQueue.prev(task) = TASK_UNLINKED;
+}
+
+// Remove a task from the ready queue and select the next running task
+void Unschedule(int task)
+{
+    if (TaskQueue[task].in_heap)
+        EdfRemove(task);
+    else if (TaskQueue.prev(task) != TASK_UNLINKED)
+        LevelRemove(task);      // A waiting task may be linked through ref into another list
+    else
+        return;
+
+    RunningTask = HighestReady();
+}
+
+// Head of the highest non-empty priority level, or the EDF job with the
+// earliest deadline. -1 if nothing is ready.
+int HighestReady(void)
+{
+    if (SchedulingPolicy == POLICY_EDF)
+        return (EdfCount > 0) ? EdfHeap[0].task : -1;
+
+    if (ReadyMap == 0) return -1;
 
-    printf("End of Schedule %s\n", TaskQueue[task].name);
+    return ReadyHead[std::bit_width(ReadyMap) - 1];
 }
 
-void Dispatch(int task)
+// The system ceiling went down: the waiting jobs of the levels above it
+// may start now (EDF only)
+void StartParkedJobs(void)
 {
-    printf("Dispatch\n");
+    int level, task;
 
-    do
+    if (SchedulingPolicy != POLICY_EDF) return;
+
+    while (ReadyMap != 0 && (level = std::bit_width(ReadyMap) - 1) > SystemCeiling)
     {
-        if (TaskQueue[RunningTask].state == TASK_READY)
+        task = ReadyHead[level];
+
+        ReadyHead[level] = -1;
+        ReadyTail[level] = -1;
+        ReadyMap &= ~(1u << level);
+
+        while (task != -1)
         {
-            TaskQueue[RunningTask].state = TASK_RUNNING;
-            TaskQueue[RunningTask].entry();
+            int next = TaskQueue.ref(task);
+
+            TaskQueue.prev(task) = TASK_UNLINKED;
+            EdfInsert(task, INSERT_TO_TAIL);
+            task = next;
+        }
+    }
+
+    RunningTask = HighestReady();
+}
+
+int SetSchedulingPolicy(int policy)
+{
+    int level, task, next;
+
+    if (policy != POLICY_PRIORITY && policy != POLICY_EDF)
+    {
+        TRACE_ERROR("ERROR: Invalid scheduling policy\n");
+        return -1;
+    }
+
+    if (policy == SchedulingPolicy) return 0;
 
-            if (TaskQueue[RunningTask].state == TASK_RUNNING)
+    TRACE_SCHEDULE("Scheduling policy %s\n", (policy == POLICY_EDF) ? "EDF" : "priority");
+
+    // The ready jobs move between the levels and the heap in place
+    if (policy == POLICY_EDF)
+    {
+        // Only jobs that may not start yet stay in their level
+        for (level = 0; level < MAX_PRIORITY; level++)
+        {
+            for (task = ReadyHead[level]; task != -1; task = next)
             {
-                TaskQueue[RunningTask].state = TASK_READY;
+                next = TaskQueue.ref(task);
+
+                if (TaskQueue[task].start != -1 || level > SystemCeiling)
+                {
+                    LevelRemove(task);
+                    EdfInsert(task, INSERT_TO_TAIL);
+                }
             }
         }
     }
-    while (RunningTask != -1 && RunningTask != task);
+    else
+    {
+        // Earliest deadline first behind the parked jobs of each level
+        while (EdfCount > 0)
+        {
+            task = EdfHeap[0].task;
+
+            EdfRemove(task);
+            LevelInsert(task, TaskQueue.ceiling(task), INSERT_TO_TAIL);
+        }
+    }
+
+    SchedulingPolicy = policy;
+
+    RunningTask = HighestReady();
+
+    Dispatch();
+
+    return 0;
+}
+
+// Switch to RunningTask if it is not the task (or OS) executing right now
+void Dispatch(void)
+{
+    int prev, next;
+
+    if (RunningTask == ActiveContext || SchedulerLock > 0) return;
+
+    // A coroutine task can only give up the processor at a co_await
+    if (IS_COTASK(ActiveContext)) return;
+
+    // Coroutine tasks are resumed by the OS context
+    next = IS_COTASK(RunningTask) ? -1 : RunningTask;
+    if (next == ActiveContext) return;
+
+    TRACE_SCHEDULE("Dispatch\n");
+
+    prev = ActiveContext;
+
+    // A preempted task stays in the ready queue
+    if (prev != -1 && TaskQueue.state(prev) == TASK_RUNNING)
+    {
+        TaskQueue.state(prev) = TASK_READY;
+    }
+
+    if (next != -1)
+    {
+        TaskQueue.state(next) = TASK_RUNNING;
+        ContextSwitches++;
+        JobStarted(next);
+        TRACE_RECORD(TRACE_EV_DISPATCH, next, prev);
+    }
+
+    SwitchContext(prev, next);
 
-    printf("End of Dispatch\n");
+    TRACE_VERBOSE("End of Dispatch\n");
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 
 #include "sys.h"
 #include "rtos_api.h"
+#include "rtos_coro.h"
+#include "rtos_config.h"
 #include "defs.h"
 
 // Declare tasks with RMA priorities (lower number = higher rate = higher priority)
@@ -14,23 +16,81 @@ DeclareTask(TaskIdle, 16);     // Lowest priority
 DeclareTask(TaskHigh, 1);      // Highest priority
 DeclareTask(TaskMedium, 5);
 DeclareTask(TaskLow, 10);
+DeclareTask(TaskEvents, 20);
+DeclareTask(TaskPiLow, 17);
+DeclareTask(TaskPiMedium, 18);
+DeclareTask(TaskPiHigh, 19);
+DeclareTask(TaskConsumer, 21);
+DeclareTask(TaskProducer, 23);
+DeclareTask(TaskFrameSink, 22);
+DeclareTask(TaskSensor, 24);
+DeclareTask(TaskAlarm, 25);
+DeclareTask(TaskLate, 26);
+
+DeclareCoTask(CoConsumer, 4);
+DeclareCoTask(CoProducer, 3);
 
 DeclareResource(Res1, 12);
 DeclareResource(Res2, 8);
 
-DeclareEvent(Event1);
-DeclareEvent(Event2);
+DeclareEvent(Event1, 0);
+DeclareEvent(Event2, 1);
+DeclareEvent(FrameReady, 2);
+
+// Resource with priority inheritance, created by TestPriorityInheritance()
+int Mutex1;
+
+// Queue of two ints, created by TestMessageQueues()
+int Queue1;
+#define QUEUE_MESSAGES 4
+
+// Sensor frames handed over without copying, see TestBufferPool()
+#define FRAME_SIZE 1024
+#define FRAMES 2
+int FramePool;
+int FrameSink;
+
+// Software counter driven by TestAlarms()
+#define ENCODER_MAX 7
+#define ENCODER_STEPS 6
 
 void TestTaskPreemption();
 void TestResourceManagement();
 void TestEventManagement();
+void TestEventMasks();
+void TestPriorityInheritance();
+void TestMessageQueues();
+void TestBufferPool();
+void TestAlarms();
 void TestRMA();
+void TestDeadlines();
+void TestCoroutines();
+
+// Statically configured system for Test 2
+TASK(ConfigSampler);
+TASK(ConfigLogger);
+
+enum {ResSensor, ResLog};
+
+constexpr TResourceConfig ConfigResources[] = {
+    ConfigResource(ResSensor, RESOURCE_CEILING),
+    ConfigResource(ResLog, RESOURCE_CEILING)
+};
+
+constexpr TEventConfig ConfigEvents[] = {
+    ConfigEvent(SampleReady)
+};
+
+constexpr TTaskConfig ConfigTasks[] = {
+    //         task           prio period deadline autostart  uses
+    ConfigTask(ConfigSampler, 3,   4,     4,       AUTOSTART, USES(ResSensor)),
+    ConfigTask(ConfigLogger,  2,   0,     0,       AUTOSTART, USES(ResSensor) | USES(ResLog))
+};
+
+DeclareSystem(ConfigSystem, ConfigTasks, ConfigResources, ConfigEvents);
+
+static_assert(ConfigSystemCeilings.value[ResSensor] == 3, "Ceiling is the highest user priority");
 
-extern int SystemTick;
-extern int TaskPeriods[MAX_TASK];
-extern int TaskDeadlines[MAX_TASK];
-extern TTask TaskQueue[MAX_TASK];
-extern int RunningTask;
 // Main test function
 int test(void)
 {
@@ -41,6 +101,9 @@ int test(void)
     char name[] = "TaskIdle";
     StartOS(TaskIdle, TaskIdleprior, name);
 
+    // Test 2: the same kernel started from a static configuration
+    printf("\n=== Test 2: Static Configuration ===\n");
+    StartOS(&ConfigSystem);
 
     return 0;
 }
@@ -53,11 +116,30 @@ TASK(TaskIdle)
     TestTaskPreemption();
     TestResourceManagement();
     TestEventManagement();
+    TestEventMasks();
+    TestPriorityInheritance();
+    TestMessageQueues();
+    TestBufferPool();
+    TestAlarms();
 
+    TestDeadlines();
     TestRMA();
 
+    TestCoroutines();
+
     printf("TaskIdle: All tests completed\n");
 
+    // Let the queued and periodic tasks run before shutting down
+    DelayTask(20);
+
+    // All jobs of a periodic task are kept under its name
+    TTaskStats stats;
+    if (GetTaskStats("TaskHigh", &stats) == 0)
+    {
+        printf("TaskIdle: TaskHigh ran %d jobs, response %d..%d ticks, start latency up to %d ticks\n",
+               stats.jobs, stats.min_response, stats.max_response, stats.max_latency);
+    }
+
     ShutdownOS();
 
     TerminateTask();
@@ -68,7 +150,7 @@ TASK(TaskHigh)
     printf("TaskHigh: Running\n");
     printf("TaskHigh: This demonstrates preemption - running before lower priority tasks complete\n");
 
-    if (TaskQueue[RunningTask].ceiling_priority > TaskHighprior)
+    if (TaskQueue.ceiling(RunningTask) > TaskHighprior)
     {
         char resName[] = "Res1";
         ReleaseResource(Res1, resName);
@@ -86,8 +168,8 @@ TASK(TaskMedium)
 
     printf("TaskMedium: Acquired resource\n");
 
-    char taskName[] = "TaskHigh";
-    ActivateTask(TaskHigh, TaskHighprior, taskName);
+    // The kernel keeps the name pointer, so it must outlive this task
+    ActivateTask(TaskHigh, TaskHighprior, (char*)"TaskHigh");
 
     printf("TaskMedium: Continuing after TaskHigh\n");
 
@@ -158,6 +240,227 @@ void TestEventManagement()
     printf("--- Event Management Test Complete ---\n");
 }
 
+// Blocks once on two events, whichever comes first wakes it
+TASK(TaskEvents)
+{
+    TEventMask events;
+
+    printf("TaskEvents: Waiting for Event1 or Event2\n");
+    WaitEvent(EVENT_MASK(Event1) | EVENT_MASK(Event2));
+
+    GetEvent(GetTaskID(), &events);
+    printf("TaskEvents: Received events 0x%x\n", (unsigned)events);
+    ClearEvent(events);
+
+    TerminateTask();
+}
+
+// Test task event masks
+void TestEventMasks()
+{
+    printf("\n--- Testing Event Masks ---\n");
+
+    int eventsTask = CreateTask(TaskEvents, TaskEventsprior, (char*)"TaskEvents");
+
+    ResumeTask(eventsTask);
+
+    printf("Main: Setting Event2 for TaskEvents\n");
+    SetEvent(eventsTask, EVENT_MASK(Event2));
+
+    printf("--- Event Masks Test Complete ---\n");
+}
+
+// Holds Mutex1 while a higher priority task wants it
+TASK(TaskPiLow)
+{
+    printf("TaskPiLow: Taking Mutex1\n");
+    GetResource(Mutex1);
+
+    ActivateTask(TaskPiHigh, TaskPiHighprior, (char*)"TaskPiHigh");
+
+    // Inherited the priority of TaskPiHigh, TaskPiMedium has to wait
+    ActivateTask(TaskPiMedium, TaskPiMediumprior, (char*)"TaskPiMedium");
+
+    printf("TaskPiLow: Releasing Mutex1 at priority %d\n", TaskQueue.ceiling(RunningTask));
+    ReleaseResource(Mutex1);
+
+    printf("TaskPiLow: Done\n");
+    TerminateTask();
+}
+
+TASK(TaskPiMedium)
+{
+    printf("TaskPiMedium: Running\n");
+    TerminateTask();
+}
+
+TASK(TaskPiHigh)
+{
+    printf("TaskPiHigh: Waiting for Mutex1\n");
+    GetResource(Mutex1);
+
+    printf("TaskPiHigh: Got Mutex1\n");
+    ReleaseResource(Mutex1);
+
+    TerminateTask();
+}
+
+// Test the priority inheritance protocol
+void TestPriorityInheritance()
+{
+    printf("\n--- Testing Priority Inheritance ---\n");
+
+    Mutex1 = CreateResource(0, RESOURCE_INHERIT, (char*)"Mutex1");
+
+    ActivateTask(TaskPiLow, TaskPiLowprior, (char*)"TaskPiLow");
+
+    printf("--- Priority Inheritance Test Complete ---\n");
+}
+
+// Lower priority than the producer, takes what fits in the queue at once
+TASK(TaskConsumer)
+{
+    int i, value;
+
+    for (i = 0; i < QUEUE_MESSAGES; i++)
+    {
+        ReceiveMessage(Queue1, &value);
+        printf("TaskConsumer: Received %d\n", value);
+    }
+
+    TerminateTask();
+}
+
+// Sends more than the queue holds, blocks until the consumer makes room
+TASK(TaskProducer)
+{
+    int i;
+
+    for (i = 1; i <= QUEUE_MESSAGES; i++)
+    {
+        printf("TaskProducer: Sending %d\n", i);
+        SendMessage(Queue1, &i);
+    }
+
+    printf("TaskProducer: Done\n");
+    TerminateTask();
+}
+
+// Test message queues between tasks
+void TestMessageQueues()
+{
+    printf("\n--- Testing Message Queues ---\n");
+
+    Queue1 = CreateQueue(sizeof(int), 2, (char*)"Queue1");
+
+    // The consumer runs first and waits on the empty queue
+    ActivateTask(TaskConsumer, TaskConsumerprior, (char*)"TaskConsumer");
+    ActivateTask(TaskProducer, TaskProducerprior, (char*)"TaskProducer");
+
+    printf("--- Message Queues Test Complete ---\n");
+}
+
+// Takes every frame sent to it and gives the block back
+TASK(TaskFrameSink)
+{
+    unsigned char* frame;
+    int received = 0;
+
+    // One wakeup may bring several frames
+    while (received < FRAMES)
+    {
+        WaitEvent(EVENT_MASK(FrameReady));
+        ClearEvent(EVENT_MASK(FrameReady));
+
+        while ((frame = (unsigned char*)ReceiveBuffer()) != NULL)
+        {
+            printf("TaskFrameSink: Frame %d, first byte %d\n", received++, frame[0]);
+            FreeBuffer(frame);
+        }
+    }
+
+    TerminateTask();
+}
+
+// Fills frames in pool blocks and passes them on
+TASK(TaskSensor)
+{
+    unsigned char* frame;
+    int i;
+
+    for (i = 0; i < FRAMES; i++)
+    {
+        frame = (unsigned char*)AllocBuffer(FramePool);
+        if (frame == NULL) break;
+
+        frame[0] = (unsigned char)(100 + i);
+        printf("TaskSensor: Sending frame %d\n", i);
+        SendBuffer(FrameSink, frame, EVENT_MASK(FrameReady));
+    }
+
+    TerminateTask();
+}
+
+// Test zero-copy buffer handoff between tasks
+void TestBufferPool()
+{
+    TBufferStats stats;
+
+    printf("\n--- Testing Buffer Pool ---\n");
+
+    FramePool = CreateBufferPool(FRAME_SIZE, FRAMES, (char*)"FramePool");
+
+    FrameSink = CreateTask(TaskFrameSink, TaskFrameSinkprior, (char*)"TaskFrameSink");
+    ResumeTask(FrameSink);
+
+    ActivateTask(TaskSensor, TaskSensorprior, (char*)"TaskSensor");
+
+    GetBufferStats(FramePool, &stats);
+    printf("FramePool: allocated %d, freed %d, failed %d, in use %d, peak %d\n",
+           stats.allocated, stats.freed, stats.failed, stats.in_use, stats.peak);
+
+    printf("--- Buffer Pool Test Complete ---\n");
+}
+
+// Activated by a one-shot alarm
+TASK(TaskAlarm)
+{
+    printf("TaskAlarm: Activated by its alarm\n");
+    TerminateTask();
+}
+
+// Called by a cyclic alarm, the scheduler is locked meanwhile
+void EncoderCallback(void)
+{
+    printf("EncoderCallback: Called\n");
+}
+
+// Test counters and alarms on a software counter
+void TestAlarms()
+{
+    int encoder, activate, callback, i, value;
+
+    printf("\n--- Testing Counters and Alarms ---\n");
+
+    encoder = CreateCounter(ENCODER_MAX, (char*)"Encoder");
+    activate = CreateAlarm(encoder, AlarmActivateTask(TaskAlarm), (char*)"AlarmActivate");
+    callback = CreateAlarm(encoder, AlarmCallback(EncoderCallback), (char*)"AlarmCallback");
+
+    SetRelAlarm(activate, 2, 0);    // Once, two steps from now
+    SetAbsAlarm(callback, 1, 3);    // At value 1, then every third step
+
+    for (i = 0; i < ENCODER_STEPS; i++)
+    {
+        IncrementCounter(encoder);
+        GetCounterValue(encoder, &value);
+        printf("Main: Encoder at %d\n", value);
+    }
+
+    CancelAlarm(callback);
+
+    printf("--- Counters and Alarms Test Complete ---\n");
+}
+
 // Test Rate Monotonic Algorithm scheduling
 void TestRMA()
 {
@@ -175,6 +478,24 @@ void TestRMA()
     SetTaskDeadline(medTask, 5);
     SetTaskDeadline(lowTask, 10);
 
+    // Charged a tick per job the set has utilization 0.8: above the
+    // Liu-Layland bound for three tasks, within the hyperbolic bound. The
+    // response times find what the bounds cannot see: TaskHigh has the
+    // lowest priority here, not the one rate monotonic order gives it.
+    SetTaskWcet(highTask, 1);
+    SetTaskWcet(medTask, 1);
+    SetTaskWcet(lowTask, 1);
+
+    TSchedulability analysis;
+    AnalyzeSchedulability(&analysis);
+    printf("RMA: utilization %.2f (Liu-Layland bound %.2f), hyperbolic product %.2f, response times %s\n",
+           analysis.utilization, analysis.liu_layland_bound, analysis.hyperbolic,
+           analysis.response_time ? "met" : "missed");
+    if (analysis.failed_task != -1)
+        printf("RMA: highest priority task that misses its deadline is %s\n", TaskQueue[TaskIndex(analysis.failed_task)].name);
+    printf("RMA: worst case responses %d, %d and %d ticks (-1: deadline missed)\n", GetResponseBound(highTask),
+           GetResponseBound(medTask), GetResponseBound(lowTask));
+
     ResumeTask(highTask);
     ResumeTask(medTask);
     ResumeTask(lowTask);
@@ -187,4 +508,122 @@ void TestRMA()
     }
 
     printf("--- RMA Scheduling Test Complete ---\n");
+}
+
+// Periodic job that takes longer than its deadline
+TASK(TaskLate)
+{
+    printf("TaskLate: Job released at tick %d\n", SystemTick);
+    DelayTask(5);
+    printf("TaskLate: Job done at tick %d\n", SystemTick);
+    TerminateTask();
+}
+
+void DeadlineAlert(int task_id, int lateness)
+{
+    printf("DeadlineAlert: a job of %s is %d ticks late\n", TaskQueue[TaskIndex(task_id)].name, lateness);
+}
+
+// Deadline misses found at the next release, first reported to a hook,
+// then aborting the late job
+void TestDeadlines()
+{
+    TTaskStats stats;
+    int i;
+
+    printf("\n--- Testing Deadline Misses ---\n");
+
+    SetDeadlineReaction(DEADLINE_HOOK, DeadlineAlert);
+
+    int lateTask = CreateTask(TaskLate, TaskLateprior, (char*)"TaskLate");
+    SetTaskPeriod(lateTask, 3);
+    SetTaskDeadline(lateTask, 2);
+    ResumeTask(lateTask);
+
+    for (i = 0; i < 4; i++)
+    {
+        SystemTick++;
+        CheckDeadlines();
+    }
+
+    printf("Aborting late jobs from now on\n");
+    SetDeadlineReaction(DEADLINE_ABORT, NULL);
+
+    for (i = 0; i < 4; i++)
+    {
+        SystemTick++;
+        CheckDeadlines();
+    }
+
+    SetTaskPeriod(lateTask, 0);
+    SetDeadlineReaction(DEADLINE_LOG, NULL);
+
+    if (GetTaskStats("TaskLate", &stats) == 0)
+    {
+        printf("TaskLate: %d misses in %d jobs, up to %d ticks late\n",
+               stats.misses, stats.jobs, stats.max_lateness);
+    }
+
+    printf("--- Deadline Misses Test Complete ---\n");
+}
+
+// Coroutine task that blocks on an event and a delay without a stack
+COTASK(CoConsumer)
+{
+    printf("CoConsumer: Waiting for Event2\n");
+    ClearEvent(Event2, (char*)"Event2");
+    co_await CoWaitEvent(Event2, (char*)"Event2");
+
+    printf("CoConsumer: Event2 received, sleeping 2 ticks\n");
+    co_await CoDelayTask(2);
+
+    printf("CoConsumer: Done at tick %d\n", SystemTick);
+    co_return;
+}
+
+COTASK(CoProducer)
+{
+    printf("CoProducer: Producing for 3 ticks\n");
+    co_await CoDelayTask(3);
+
+    printf("CoProducer: Setting Event2\n");
+    SetEvent(Event2, (char*)"Event2");
+    co_await CoSchedule();
+
+    printf("CoProducer: Done\n");
+    co_return;
+}
+
+TASK(ConfigSampler)
+{
+    GetResource(ResSensor);
+    printf("ConfigSampler: Sample at tick %d\n", SystemTick);
+    ReleaseResource(ResSensor);
+
+    TerminateTask();
+}
+
+TASK(ConfigLogger)
+{
+    GetResource(ResSensor);
+    printf("ConfigLogger: Sensor ceiling %d\n", TaskQueue.ceiling(RunningTask));
+    ReleaseResource(ResSensor);
+
+    DelayTask(10);
+
+    printf("ConfigLogger: Done at tick %d\n", SystemTick);
+    ShutdownOS();
+
+    TerminateTask();
+}
+
+// Test coroutine tasks, they run once TaskIdle waits
+void TestCoroutines()
+{
+    printf("\n--- Testing Coroutine Tasks ---\n");
+
+    ActivateCoTask(CoConsumer, CoConsumerprior, (char*)"CoConsumer");
+    ActivateCoTask(CoProducer, CoProducerprior, (char*)"CoProducer");
+
+    printf("--- Coroutine Tasks Activated ---\n");
 }
\ No newline at end of file
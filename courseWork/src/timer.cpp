@@ -0,0 +1,203 @@
+/*************************************/
+/*              timer.cpp              */
+/*************************************/
+
+#include <bit>
+#include <stdint.h>
+
+#include "sys.h"
+
+// Hierarchical timer wheel. Level 0 has one slot per tick, every further
+// level covers TIMER_WHEEL_SIZE slots of the level below. A tick only runs
+// the timers of its level 0 slot, the upper levels are cascaded down when
+// the lower level wraps around. Every counter has a wheel of its own, the
+// task timers are on the wheel of the system counter.
+
+#define TIMER_LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_BITS)
+#define TIMER_SLOT_MASK (TIMER_WHEEL_SIZE - 1)
+
+static_assert(TIMER_WHEEL_SIZE == 64, "A wheel map holds one bit per slot");
+
+// Wheel a timer runs on: alarms on the one of their counter
+static TTimerWheel* WheelOf(int timer)
+{
+    if (IS_ALARM_TIMER(timer))
+        return &CounterQueue[AlarmQueue[timer - ALARM_TIMER_BASE].counter].wheel;
+
+    return &SystemWheel;
+}
+
+static void LinkTimer(TTimerWheel* wheel, int timer)
+{
+    int delta, level, slot, head;
+
+    delta = TIMER(timer).expire - wheel->tick;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+    {
+        if (delta < (1 << TIMER_LEVEL_SHIFT(level + 1))) break;
+    }
+
+    slot = level * TIMER_WHEEL_SIZE +
+           ((TIMER(timer).expire >> TIMER_LEVEL_SHIFT(level)) & TIMER_SLOT_MASK);
+
+    head = wheel->slots[slot];
+
+    TIMER(timer).slot = slot;
+    TIMER(timer).prev = -1;
+    TIMER(timer).ref = head;
+
+    if (head != -1)
+        TIMER(head).prev = timer;
+
+    wheel->slots[slot] = timer;
+    wheel->map[level] |= (uint64_t)1 << (slot & TIMER_SLOT_MASK);
+}
+
+static void UnlinkTimer(TTimerWheel* wheel, int timer)
+{
+    int prev, next;
+
+    prev = TIMER(timer).prev;
+    next = TIMER(timer).ref;
+
+    if (prev == -1)
+    {
+        wheel->slots[TIMER(timer).slot] = next;
+
+        if (next == -1)
+            wheel->map[TIMER(timer).slot / TIMER_WHEEL_SIZE] &=
+                ~((uint64_t)1 << (TIMER(timer).slot & TIMER_SLOT_MASK));
+    }
+    else
+        TIMER(prev).ref = next;
+
+    if (next != -1)
+        TIMER(next).prev = prev;
+
+    TIMER(timer).slot = -1;
+}
+
+// Move all timers of an upper level slot to the levels below
+static int CascadeTimers(TTimerWheel* wheel, int level)
+{
+    int index, timer, next;
+
+    index = (wheel->tick >> TIMER_LEVEL_SHIFT(level)) & TIMER_SLOT_MASK;
+
+    timer = wheel->slots[level * TIMER_WHEEL_SIZE + index];
+    wheel->slots[level * TIMER_WHEEL_SIZE + index] = -1;
+    wheel->map[level] &= ~((uint64_t)1 << index);
+
+    while (timer != -1)
+    {
+        next = TIMER(timer).ref;
+        LinkTimer(wheel, timer);
+        timer = next;
+    }
+
+    return index;
+}
+
+void InitWheel(TTimerWheel* wheel)
+{
+    int i;
+
+    wheel->tick = 0;
+
+    for (i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SIZE; i++)
+    {
+        wheel->slots[i] = -1;
+    }
+
+    for (i = 0; i < TIMER_WHEEL_LEVELS; i++)
+    {
+        wheel->map[i] = 0;
+    }
+}
+
+void StartTimer(int timer, int expire)
+{
+    TTimerWheel* wheel = WheelOf(timer);
+
+    if (TIMER(timer).slot != -1)
+        UnlinkTimer(wheel, timer);
+
+    // The current tick is already processed, a due timer runs on the next one
+    if (expire <= wheel->tick)
+        expire = wheel->tick + 1;
+
+    TIMER(timer).expire = expire;
+    LinkTimer(wheel, timer);
+}
+
+void StopTimer(int timer)
+{
+    if (TIMER(timer).slot != -1)
+        UnlinkTimer(WheelOf(timer), timer);
+}
+
+// Earliest expiry of all running timers of the system counter, -1 if
+// there is none
+int NextTimerExpiry(void)
+{
+    TTimerWheel* wheel = &SystemWheel;
+    int level, index, slot, timer;
+    int next;
+    uint64_t map;
+
+    next = -1;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        if (wheel->map[level] == 0) continue;
+
+        // Rotate so that the slot after the current one becomes bit 0,
+        // the first set bit is then the nearest non-empty slot
+        index = ((wheel->tick >> TIMER_LEVEL_SHIFT(level)) + 1) & TIMER_SLOT_MASK;
+        map = std::rotr(wheel->map[level], index);
+        slot = level * TIMER_WHEEL_SIZE + ((index + std::countr_zero(map)) & TIMER_SLOT_MASK);
+
+        for (timer = wheel->slots[slot]; timer != -1; timer = TIMER(timer).ref)
+        {
+            if (next == -1 || TIMER(timer).expire < next)
+                next = TIMER(timer).expire;
+        }
+    }
+
+    return next;
+}
+
+// Run every timer of a wheel that expires up to and including the given tick
+void AdvanceWheel(TTimerWheel* wheel, int tick)
+{
+    int level, timer;
+
+    while (wheel->tick < tick)
+    {
+        wheel->tick++;
+
+        if ((wheel->tick & TIMER_SLOT_MASK) == 0)
+        {
+            for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+            {
+                if (CascadeTimers(wheel, level) != 0) break;
+            }
+        }
+
+        while ((timer = wheel->slots[wheel->tick & TIMER_SLOT_MASK]) != -1)
+        {
+            UnlinkTimer(wheel, timer);
+
+            if (TIMER(timer).expire > wheel->tick)
+                LinkTimer(wheel, timer);    // Beyond the wheel range, not due yet
+            else
+                TimerExpired(timer);
+        }
+    }
+}
+
+void AdvanceTimers(int tick)
+{
+    AdvanceWheel(&SystemWheel, tick);
+}
@@ -0,0 +1,54 @@
+/*************************************/
+/*              trace.cpp              */
+/*************************************/
+
+#include <stdio.h>
+
+#include "sys.h"
+
+#ifdef RTOS_TRACE_BUFFER
+
+// Write the ring to a file, oldest record first
+int TraceDump(const char* path)
+{
+    TTraceHeader header;
+    FILE* file;
+    uint32_t first, i;
+
+    file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        TRACE_ERROR("ERROR: Cannot open trace file %s\n", path);
+        return -1;
+    }
+
+    header.magic = TRACE_FILE_MAGIC;
+    header.version = TRACE_FILE_VERSION;
+    header.record_size = sizeof(TTraceRecord);
+    header.count = TraceHead < TRACE_BUFFER_SIZE ? TraceHead : TRACE_BUFFER_SIZE;
+    header.dropped = TraceHead - header.count;
+
+    fwrite(&header, sizeof(header), 1, file);
+
+    first = TraceHead - header.count;
+    for (i = 0; i < header.count; i++)
+    {
+        fwrite(&TraceBuffer[(first + i) & (TRACE_BUFFER_SIZE - 1)], sizeof(TTraceRecord), 1, file);
+    }
+
+    fclose(file);
+
+    TRACE_SCHEDULE("Trace written to %s (%u records)\n", path, header.count);
+
+    return 0;
+}
+
+#else
+
+int TraceDump([[maybe_unused]] const char* path)
+{
+    TRACE_ERROR("ERROR: Trace buffer is not compiled in\n");
+    return -1;
+}
+
+#endif
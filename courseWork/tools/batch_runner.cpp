@@ -0,0 +1,322 @@
+/*************************************/
+/*          batch_runner.cpp           */
+/*************************************/
+
+// Runs many task sets at once, one kernel per worker thread:
+//     batchRunner scenarios.txt [threads]
+//
+// Scenario file:
+//     scenario <name> <ticks>
+//     policy <priority|edf>           (optional, priority by default)
+//     task <name> <priority> <period> <deadline> <wcet>
+//     ...
+// Lines starting with # are comments. A task burns its wcet in ticks
+// on every release, like the loop in TestRMA(). The table puts the
+// misses next to what the schedulability analysis predicted for the set,
+// a response above a passed RTA bound fails the run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "sys.h"
+#include "rtos_api.h"
+
+#define SCENARIO_NAME_SIZE 32
+
+typedef struct Type_scenario_task
+{
+    char name[SCENARIO_NAME_SIZE];
+    int priority;
+    int period;
+    int deadline;
+    int wcet;
+} TScenarioTask;
+
+typedef struct Type_scenario
+{
+    char name[SCENARIO_NAME_SIZE];
+    int ticks;
+    int policy;
+    std::vector<TScenarioTask> tasks;
+    int tick_pending;
+
+    // Summary
+    int deadline_misses;
+    int max_response;
+    int context_switches;
+    TSchedulability analysis;
+    int response_bound;         // -1 unless fixed priorities pass the RTA
+} TScenario;
+
+// Scenario run by the calling worker thread
+static thread_local TScenario* CurrentScenario;
+
+// Releases and deadline checks of the current tick, an overloaded task
+// set never lets ScenarioClock run again so the end is checked here
+static void ReleaseTick(void)
+{
+    CheckDeadlines();
+
+    if (SystemTick >= CurrentScenario->ticks)
+        ShutdownOS();
+}
+
+// Advance time by one tick from inside a task. A job burning its last
+// tick has finished by the end of it: the releases of that tick wait
+// until the job terminated, the next task to burn a tick runs them.
+static void BurnTick(bool last)
+{
+    if (CurrentScenario->tick_pending)
+    {
+        CurrentScenario->tick_pending = 0;
+        ReleaseTick();
+    }
+
+    SystemTick++;
+
+    if (last)
+        CurrentScenario->tick_pending = 1;
+    else
+        ReleaseTick();
+}
+
+TASK(ScenarioTask)
+{
+    int i, wcet;
+
+    wcet = 0;
+
+    // Jobs share the name pointer of their scenario entry
+    for (TScenarioTask& task : CurrentScenario->tasks)
+    {
+        if (task.name == TaskQueue[RunningTask].name)
+            wcet = task.wcet;
+    }
+
+    for (i = 0; i < wcet; i++)
+    {
+        BurnTick(i == wcet - 1);
+    }
+
+    TerminateTask();
+}
+
+// Lowest priority task, it creates the task set and keeps the clock going
+TASK(ScenarioClock)
+{
+    std::vector<int> ids;
+    int id;
+
+    SetSchedulingPolicy(CurrentScenario->policy);
+    SetStatsOutput(NULL);
+
+    // The first jobs of all tasks are released together at tick 0
+    SchedulerLock++;
+
+    for (TScenarioTask& task : CurrentScenario->tasks)
+    {
+        id = CreateTask(ScenarioTask, task.priority, task.name);
+        if (id == -1) continue;
+
+        SetTaskPeriod(id, task.period);
+        SetTaskDeadline(id, task.deadline);
+        SetTaskWcet(id, task.wcet);
+        ResumeTask(id);
+        ids.push_back(id);
+    }
+
+    AnalyzeSchedulability(&CurrentScenario->analysis);
+
+    // Released together at tick 0 without resources, the first job of
+    // each task meets its critical instant: the largest response reaches
+    // the largest bound and never passes it
+    CurrentScenario->response_bound = -1;
+    if (CurrentScenario->policy == POLICY_PRIORITY && CurrentScenario->analysis.response_time)
+    {
+        for (int task_id : ids)
+        {
+            if (GetResponseBound(task_id) > CurrentScenario->response_bound)
+                CurrentScenario->response_bound = GetResponseBound(task_id);
+        }
+    }
+
+    SchedulerLock--;
+    Dispatch();
+
+    while (!OsShutdown)
+    {
+        BurnTick(false);
+    }
+}
+
+static void RunScenario(TScenario* scenario)
+{
+    CurrentScenario = scenario;
+    scenario->tick_pending = 0;
+
+    StartOS(ScenarioClock, 0, (char*)"ScenarioClock");
+
+    scenario->deadline_misses = DeadlineMisses;
+    scenario->max_response = MaxResponse;
+    scenario->context_switches = ContextSwitches;
+}
+
+static int LoadScenarios(const char* path, std::vector<TScenario>& scenarios)
+{
+    char line[256];
+    char word[16];
+    FILE* file;
+    int number;
+    TScenarioTask task;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot open %s\n", path);
+        return -1;
+    }
+
+    number = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        number++;
+
+        if (sscanf(line, "%15s", word) != 1 || word[0] == '#') continue;
+
+        if (strcmp(word, "scenario") == 0)
+        {
+            scenarios.emplace_back();
+            scenarios.back().policy = POLICY_PRIORITY;
+            if (sscanf(line, "%*s %31s %d", scenarios.back().name, &scenarios.back().ticks) != 2)
+            {
+                printf("ERROR: %s:%d: expected scenario <name> <ticks>\n", path, number);
+                fclose(file);
+                return -1;
+            }
+        }
+        else if (strcmp(word, "policy") == 0 && !scenarios.empty())
+        {
+            if (sscanf(line, "%*s %15s", word) == 1 && strcmp(word, "priority") == 0)
+                scenarios.back().policy = POLICY_PRIORITY;
+            else if (sscanf(line, "%*s %15s", word) == 1 && strcmp(word, "edf") == 0)
+                scenarios.back().policy = POLICY_EDF;
+            else
+            {
+                printf("ERROR: %s:%d: expected policy <priority|edf>\n", path, number);
+                fclose(file);
+                return -1;
+            }
+        }
+        else if (strcmp(word, "task") == 0 && !scenarios.empty())
+        {
+            if (sscanf(line, "%*s %31s %d %d %d %d", task.name, &task.priority,
+                       &task.period, &task.deadline, &task.wcet) != 5 ||
+                task.priority <= 0 || task.priority >= MAX_PRIORITY)
+            {
+                printf("ERROR: %s:%d: expected task <name> <priority 1..%d> <period> <deadline> <wcet>\n",
+                       path, number, MAX_PRIORITY - 1);
+                fclose(file);
+                return -1;
+            }
+
+            if (scenarios.back().tasks.size() >= MAX_TASK / 2)
+            {
+                printf("ERROR: %s:%d: too many tasks in scenario %s\n", path, number, scenarios.back().name);
+                fclose(file);
+                return -1;
+            }
+
+            scenarios.back().tasks.push_back(task);
+        }
+        else
+        {
+            printf("ERROR: %s:%d: unexpected line\n", path, number);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<TScenario> scenarios;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next(0);
+    unsigned threads, i;
+    int result;
+
+    if (argc < 2 || argc > 3)
+    {
+        printf("Usage: %s <scenario file> [threads]\n", argv[0]);
+        return 1;
+    }
+
+    if (LoadScenarios(argv[1], scenarios) == -1) return 1;
+
+    threads = std::thread::hardware_concurrency();
+    if (argc == 3) threads = (unsigned)atoi(argv[2]);
+    if (threads == 0) threads = 1;
+    if (threads > scenarios.size()) threads = (unsigned)scenarios.size();
+
+    // Each worker owns a kernel and takes the next scenario until none is left
+    for (i = 0; i < threads; i++)
+    {
+        workers.emplace_back([&scenarios, &next]()
+        {
+            TKernel* kernel;
+            size_t index;
+
+            kernel = CreateKernel();
+            SelectKernel(kernel);
+
+            while ((index = next++) < scenarios.size())
+            {
+                RunScenario(&scenarios[index]);
+            }
+
+            SelectKernel(NULL);
+            DeleteKernel(kernel);
+        });
+    }
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    // Analysis columns: the largest RTA bound of a fixed priority set that
+    // passes it, utilization, then yes if the Liu-Layland bound, the
+    // hyperbolic bound, the response time analysis and the EDF test pass
+    printf("%-24s %8s %8s %6s %8s %6s %4s %4s %4s %4s\n", "scenario", "misses", "max_resp", "bound",
+           "switches", "util", "ll", "hyp", "rta", "edf");
+    for (TScenario& scenario : scenarios)
+    {
+        printf("%-24s %8d %8d %6d %8d %6.3f %4s %4s %4s %4s\n", scenario.name, scenario.deadline_misses,
+               scenario.max_response, scenario.response_bound, scenario.context_switches,
+               scenario.analysis.utilization, scenario.analysis.liu_layland ? "yes" : "no",
+               scenario.analysis.hyperbolic_ok ? "yes" : "no", scenario.analysis.response_time ? "yes" : "no",
+               scenario.analysis.edf ? "yes" : "no");
+    }
+
+    // A run that contradicts its own analysis fails the batch
+    result = 0;
+    for (TScenario& scenario : scenarios)
+    {
+        if (scenario.response_bound != -1 && scenario.max_response > scenario.response_bound)
+        {
+            printf("ERROR: %s responded in %d ticks, above its bound of %d\n", scenario.name,
+                   scenario.max_response, scenario.response_bound);
+            result = 1;
+        }
+    }
+
+    return result;
+}
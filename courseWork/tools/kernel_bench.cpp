@@ -0,0 +1,504 @@
+/*************************************/
+/*          kernel_bench.cpp           */
+/*************************************/
+
+// Host nanoseconds per kernel operation at several task counts:
+//     kernelBench [results.json] [baseline.json]
+//
+// Every measurement runs in a fresh StartOS() with a driver task that
+// never blocks, the other tasks of the count sit in the ready queue below
+// it (or wait, for the event benchmark). Results are written as JSON, one
+// result per line. With a baseline the growth of every operation from the
+// smallest task count is compared with the growth in the baseline, the
+// run fails when it grew more than BENCH_TOLERANCE times as much. Growth
+// is compared instead of absolute times so the baseline holds on other
+// machines. The operations meant to be O(1) must also stay flat on their
+// own: growing more than BENCH_FLAT_LIMIT times fails even when the
+// baseline grew as well.
+//
+// Build with optimizations (CMAKE_BUILD_TYPE=Release). The checked-in
+// baseline is tools/kernel_bench_baseline.json, refresh it with
+//     kernelBench ../tools/kernel_bench_baseline.json
+// when a change is meant to alter the scaling.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "sys.h"
+#include "rtos_api.h"
+
+#define BENCH_BATCH 256             // Tasks activated, scheduled and terminated per round
+#define BENCH_ROUNDS 64
+#define BENCH_REPEATS 5             // Best of, against noise of the host
+#define BENCH_TOLERANCE 2.0
+#define BENCH_FLAT_LIMIT 2.0       // Growth allowed to an O(1) operation, cache effects included
+#define BENCH_NAME_SIZE 32
+
+#define DRIVER_PRIORITY 16
+#define BACKGROUND_PRIORITY 2       // Ready tasks of the count, never run
+#define PARTNER_PRIORITY 24         // Preempts the driver
+
+static const int TaskCounts[] = {8, 64, 512};
+
+static_assert(MAX_TASK >= 512 + BENCH_BATCH + 2, "Benchmark needs MAX_TASK slots for its task counts");
+
+typedef struct Type_bench_result
+{
+    char op[BENCH_NAME_SIZE];
+    int tasks;
+    double ns;
+
+} TBenchResult;
+
+typedef void TBenchCall(int tasks);
+
+typedef struct Type_bench
+{
+    const char* op;
+    TBenchCall* bench;
+    int flat;                       // O(1), the time does not depend on the task count
+
+} TBench;
+
+// Benchmark run by the driver task and its result
+static TBenchCall* CurrentBench;
+static int CurrentTasks;
+static double CurrentNs;
+static int IdleStats;               // Statistics entry of BenchIdle in the running kernel
+
+DeclareEvent(BenchEvent, 0);
+
+static double NowNs(void)
+{
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TASK(BenchIdle)
+{
+    TerminateTask();
+}
+
+// Resumed by the driver, gives the processor straight back
+TASK(BenchPartner)
+{
+    while (1)
+    {
+        SuspendTask(GetTaskID());
+    }
+}
+
+// Waits on BenchEvent forever, higher priority than the driver
+TASK(BenchWaiter)
+{
+    while (1)
+    {
+        WaitEvent(BenchEvent, (char*)"BenchEvent");
+    }
+}
+
+static void AddReadyTasks(int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        StartTask(BenchIdle, NULL, BACKGROUND_PRIORITY, (char*)"BenchIdle", IdleStats);
+    }
+}
+
+// StartTask() is ActivateTask() returning the slot. The tasks have a
+// lower priority than the driver, nothing switches.
+static void BenchActivate(int tasks)
+{
+    int slots[BENCH_BATCH];
+    int round, i;
+    double start, total;
+
+    AddReadyTasks(tasks);
+
+    total = 0;
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        start = NowNs();
+        for (i = 0; i < BENCH_BATCH; i++)
+        {
+            slots[i] = StartTask(BenchIdle, NULL, BACKGROUND_PRIORITY, (char*)"BenchIdle", IdleStats);
+        }
+        total += NowNs() - start;
+
+        for (i = 0; i < BENCH_BATCH; i++)
+        {
+            EndTask(slots[i]);
+        }
+    }
+
+    CurrentNs = total / (BENCH_ROUNDS * BENCH_BATCH);
+}
+
+// EndTask() is the kernel side of TerminateTask(), the switch away from
+// the ending task is what the dispatch benchmark measures
+static void BenchTerminate(int tasks)
+{
+    int slots[BENCH_BATCH];
+    int round, i;
+    double start, total;
+
+    AddReadyTasks(tasks);
+
+    total = 0;
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (i = 0; i < BENCH_BATCH; i++)
+        {
+            slots[i] = StartTask(BenchIdle, NULL, BACKGROUND_PRIORITY, (char*)"BenchIdle", IdleStats);
+        }
+
+        start = NowNs();
+        for (i = 0; i < BENCH_BATCH; i++)
+        {
+            EndTask(slots[i]);
+        }
+        total += NowNs() - start;
+    }
+
+    CurrentNs = total / (BENCH_ROUNDS * BENCH_BATCH);
+}
+
+static void BenchSchedule(int tasks)
+{
+    int slots[BENCH_BATCH];
+    int round, i;
+    double start, total;
+
+    AddReadyTasks(tasks);
+
+    for (i = 0; i < BENCH_BATCH; i++)
+    {
+        slots[i] = StartTask(BenchIdle, NULL, BACKGROUND_PRIORITY, (char*)"BenchIdle", IdleStats);
+    }
+
+    total = 0;
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (i = BENCH_BATCH - 1; i >= 0; i--)
+        {
+            Unschedule(slots[i]);
+        }
+
+        start = NowNs();
+        for (i = 0; i < BENCH_BATCH; i++)
+        {
+            Schedule(slots[i], INSERT_TO_TAIL);
+        }
+        total += NowNs() - start;
+    }
+
+    CurrentNs = total / (BENCH_ROUNDS * BENCH_BATCH);
+}
+
+// A resume that preempts the driver and the switch back, per switch
+static void BenchDispatch(int tasks)
+{
+    int partner, i, count;
+    double start;
+
+    AddReadyTasks(tasks);
+
+    partner = CreateTask(BenchPartner, PARTNER_PRIORITY, (char*)"BenchPartner");
+    ResumeTask(partner);
+
+    count = BENCH_ROUNDS * BENCH_BATCH;
+
+    start = NowNs();
+    for (i = 0; i < count; i++)
+    {
+        ResumeTask(partner);
+    }
+    CurrentNs = (NowNs() - start) / (2 * count);
+}
+
+// Wakes all waiters, the scheduler is locked so only SetEvent() is timed
+static void BenchSetEvent(int tasks)
+{
+    int i, count;
+    double start, total;
+
+    for (i = 0; i < tasks; i++)
+    {
+        ActivateTask(BenchWaiter, PARTNER_PRIORITY, (char*)"BenchWaiter");
+    }
+
+    count = BENCH_ROUNDS;
+
+    total = 0;
+    for (i = 0; i < count; i++)
+    {
+        SchedulerLock++;
+
+        start = NowNs();
+        SetEvent(BenchEvent, (char*)"BenchEvent");
+        total += NowNs() - start;
+
+        ClearEvent(BenchEvent, (char*)"BenchEvent");
+        SchedulerLock--;
+
+        // The waiters run and wait again
+        Dispatch();
+    }
+
+    CurrentNs = total / count;
+}
+
+static void BenchResource(int tasks)
+{
+    int i, count, handle;
+    double start;
+
+    AddReadyTasks(tasks);
+
+    count = BENCH_ROUNDS * BENCH_BATCH;
+
+    start = NowNs();
+    for (i = 0; i < count; i++)
+    {
+        handle = GetResource(DRIVER_PRIORITY + 4, (char*)"BenchResource");
+        ReleaseResource(handle);
+    }
+    CurrentNs = (NowNs() - start) / count;
+}
+
+// Ticks on which no release is due, every task has a pending release timer
+static void BenchTick(int tasks)
+{
+    int i, count, task;
+    double start;
+
+    for (i = 0; i < tasks; i++)
+    {
+        task = CreateTask(BenchIdle, BACKGROUND_PRIORITY, (char*)"BenchPeriodic");
+        SetTaskPeriod(task, (1 << 20) + i);
+    }
+
+    count = BENCH_ROUNDS * BENCH_BATCH;
+
+    start = NowNs();
+    for (i = 0; i < count; i++)
+    {
+        SystemTick++;
+        CheckDeadlines();
+    }
+    CurrentNs = (NowNs() - start) / count;
+}
+
+TASK(BenchDriver)
+{
+    IdleStats = FindTaskStats("BenchIdle");
+    SetStatsOutput(NULL);
+
+    CurrentBench(CurrentTasks);
+
+    ShutdownOS();
+}
+
+static double RunBench(TBenchCall* bench, int tasks)
+{
+    double best;
+    int i;
+
+    CurrentBench = bench;
+    CurrentTasks = tasks;
+
+    best = -1;
+    for (i = 0; i < BENCH_REPEATS; i++)
+    {
+        StartOS(BenchDriver, DRIVER_PRIORITY, (char*)"BenchDriver");
+
+        if (best < 0 || CurrentNs < best)
+            best = CurrentNs;
+    }
+
+    return best;
+}
+
+static int WriteResults(const char* path, std::vector<TBenchResult>& results)
+{
+    FILE* file;
+    size_t i;
+
+    file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot write %s\n", path);
+        return -1;
+    }
+
+    fprintf(file, "{\n  \"unit\": \"ns\",\n  \"results\": [\n");
+    for (i = 0; i < results.size(); i++)
+    {
+        fprintf(file, "    {\"op\": \"%s\", \"tasks\": %d, \"ns\": %.2f}%s\n", results[i].op,
+                results[i].tasks, results[i].ns, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+
+    return 0;
+}
+
+// Reads the files WriteResults() writes, one result per line
+static int LoadResults(const char* path, std::vector<TBenchResult>& results)
+{
+    char line[256];
+    FILE* file;
+    TBenchResult result;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot open %s\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (sscanf(line, " {\"op\": \"%31[^\"]\", \"tasks\": %d, \"ns\": %lf", result.op,
+                   &result.tasks, &result.ns) == 3)
+        {
+            results.push_back(result);
+        }
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+static const TBenchResult* FindResult(std::vector<TBenchResult>& results, const char* op, int tasks)
+{
+    for (TBenchResult& result : results)
+    {
+        if (strcmp(result.op, op) == 0 && result.tasks == tasks)
+            return &result;
+    }
+
+    return NULL;
+}
+
+// Setting an event wakes all of its waiters, one per task of the count
+static const TBench Benches[] = {
+    {"activate", BenchActivate, 1},
+    {"terminate", BenchTerminate, 1},
+    {"schedule", BenchSchedule, 1},
+    {"dispatch", BenchDispatch, 1},
+    {"set_event", BenchSetEvent, 0},
+    {"resource", BenchResource, 1},
+    {"tick", BenchTick, 1}
+};
+
+static bool IsFlat(const char* op)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(Benches) / sizeof(Benches[0]); i++)
+    {
+        if (strcmp(Benches[i].op, op) == 0)
+            return Benches[i].flat;
+    }
+
+    return false;
+}
+
+// Growth of every operation from the smallest task count, baseline and now
+static int CompareResults(std::vector<TBenchResult>& results, std::vector<TBenchResult>& baseline)
+{
+    const TBenchResult* first;
+    const TBenchResult* base;
+    const TBenchResult* base_first;
+    double growth, base_growth;
+    int regressions;
+
+    printf("\n%-12s %6s %10s %10s %8s %8s\n", "op", "tasks", "ns", "base_ns", "growth", "base");
+
+    regressions = 0;
+    for (TBenchResult& result : results)
+    {
+        first = FindResult(results, result.op, TaskCounts[0]);
+        base = FindResult(baseline, result.op, result.tasks);
+        base_first = FindResult(baseline, result.op, TaskCounts[0]);
+
+        if (first == NULL || base == NULL || base_first == NULL)
+        {
+            printf("%-12s %6d %10.2f %10s\n", result.op, result.tasks, result.ns, "-");
+            continue;
+        }
+
+        growth = result.ns / first->ns;
+        base_growth = base->ns / base_first->ns;
+
+        printf("%-12s %6d %10.2f %10.2f %8.2f %8.2f", result.op, result.tasks, result.ns,
+               base->ns, growth, base_growth);
+
+        if (growth > base_growth * BENCH_TOLERANCE)
+        {
+            printf("  REGRESSION");
+            regressions++;
+        }
+        else if (IsFlat(result.op) && growth > BENCH_FLAT_LIMIT)
+        {
+            printf("  NOT O(1)");
+            regressions++;
+        }
+        printf("\n");
+    }
+
+    return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<TBenchResult> results, baseline;
+    TBenchResult result;
+    size_t i, j;
+    int regressions;
+
+    if (argc > 3)
+    {
+        printf("Usage: %s [results.json] [baseline.json]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-12s %6s %10s\n", "op", "tasks", "ns");
+
+    for (i = 0; i < sizeof(Benches) / sizeof(Benches[0]); i++)
+    {
+        for (j = 0; j < sizeof(TaskCounts) / sizeof(TaskCounts[0]); j++)
+        {
+            snprintf(result.op, sizeof(result.op), "%s", Benches[i].op);
+            result.tasks = TaskCounts[j];
+            result.ns = RunBench(Benches[i].bench, TaskCounts[j]);
+
+            printf("%-12s %6d %10.2f\n", result.op, result.tasks, result.ns);
+            results.push_back(result);
+        }
+    }
+
+    if (argc >= 2 && WriteResults(argv[1], results) == -1) return 1;
+
+    if (argc == 3)
+    {
+        if (LoadResults(argv[2], baseline) == -1) return 1;
+
+        regressions = CompareResults(results, baseline);
+        if (regressions > 0)
+        {
+            printf("%d results scale worse than the baseline\n", regressions);
+            return 1;
+        }
+    }
+
+    return 0;
+}
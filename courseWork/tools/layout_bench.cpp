@@ -0,0 +1,249 @@
+/*************************************/
+/*          layout_bench.cpp           */
+/*************************************/
+
+// Compares the task slot layouts on the accesses the scheduler makes:
+//     layoutBench [rounds]
+//
+// aos: one control block per task, hot and cold fields interleaved (the
+//      TTask layout before the hot fields moved out)
+// soa: TTaskChunk, the hot fields one array per field
+//
+// walk: follow a queue linked through ref in random slot order, reading
+//       the ceiling and state of every task (Schedule, GrantResource)
+// scan: count the ready tasks at or above a priority over all slots
+//
+// Build with optimizations (CMAKE_BUILD_TYPE=Release), the numbers of
+// an unoptimized build mostly measure the index arithmetic.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "sys.h"
+
+// TTask before the structure of arrays split
+typedef struct Type_aos_task
+{
+    int ref;
+    int priority;
+    int ceiling_priority;
+    int state;
+    int waiting_event;
+    TEventMask events_set;
+    TEventMask events_waited;
+    int resources;
+    int blocked_on;
+    int generation;
+    void (*entry)(void);
+    void* coroutine;
+    char* name;
+    int period;
+    int deadline;
+    int last_run;
+    TTimer timers[2];
+    void* context;
+    char fresh;
+
+} TAosTask;
+
+typedef struct Type_bench_result
+{
+    double walk_ns;     // Per visited task
+    double scan_ns;     // Per slot
+    long checksum;      // Keeps the loops from being optimized out
+
+} TBenchResult;
+
+static double NsSince(std::chrono::steady_clock::time_point start, long operations)
+{
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() / operations;
+}
+
+// Same queue, priorities and states for both layouts
+static void MakeTaskSet(int count, std::vector<int>& next, std::vector<int>& priority,
+                        std::vector<int>& state)
+{
+    std::mt19937 random(count);
+    std::vector<int> order(count);
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), random);
+
+    next.assign(count, -1);
+    priority.resize(count);
+    state.resize(count);
+
+    for (i = 0; i < count; i++)
+    {
+        next[order[i]] = (i + 1 < count) ? order[i + 1] : order[0];
+        priority[i] = random() % MAX_PRIORITY;
+        state[i] = (random() % 4 == 0) ? TASK_SUSPENDED : TASK_READY;
+    }
+}
+
+static TBenchResult RunAos(int count, int rounds)
+{
+    std::vector<int> next, priority, state;
+    std::vector<TAosTask> tasks;
+    TBenchResult result;
+    int i, round, task, minimum;
+    long sum;
+
+    MakeTaskSet(count, next, priority, state);
+
+    tasks.resize(count);
+    for (i = 0; i < count; i++)
+    {
+        tasks[i].ref = next[i];
+        tasks[i].ceiling_priority = priority[i];
+        tasks[i].state = state[i];
+    }
+
+    sum = 0;
+    task = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (round = 0; round < rounds; round++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            if (tasks[task].state == TASK_READY)
+                sum += tasks[task].ceiling_priority;
+            task = tasks[task].ref;
+        }
+    }
+    result.walk_ns = NsSince(start, (long)rounds * count);
+
+    start = std::chrono::steady_clock::now();
+    for (round = 0; round < rounds; round++)
+    {
+        minimum = round % MAX_PRIORITY;
+
+        for (i = 0; i < count; i++)
+        {
+            sum += (tasks[i].state == TASK_READY) & (tasks[i].ceiling_priority >= minimum);
+        }
+    }
+    result.scan_ns = NsSince(start, (long)rounds * count);
+
+    result.checksum = sum;
+    return result;
+}
+
+static TBenchResult RunSoa(int count, int rounds)
+{
+    std::vector<int> next, priority, state;
+    std::vector<TTaskChunk*> chunks;
+    TBenchResult result;
+    TTaskChunk* chunk;
+    int i, round, task, minimum, size, ready;
+    long sum;
+
+    MakeTaskSet(count, next, priority, state);
+
+    chunks.resize((count + TASK_CHUNK_SIZE - 1) / TASK_CHUNK_SIZE);
+    for (i = 0; i < (int)chunks.size(); i++)
+    {
+        chunks[i] = (TTaskChunk*)calloc(1, sizeof(TTaskChunk));
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        chunk = chunks[i / TASK_CHUNK_SIZE];
+        chunk->ref[i % TASK_CHUNK_SIZE] = next[i];
+        chunk->ceiling_priority[i % TASK_CHUNK_SIZE] = (int8_t)priority[i];
+        chunk->state[i % TASK_CHUNK_SIZE] = (uint8_t)state[i];
+    }
+
+    sum = 0;
+    task = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (round = 0; round < rounds; round++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            chunk = chunks[task / TASK_CHUNK_SIZE];
+            if (chunk->state[task % TASK_CHUNK_SIZE] == TASK_READY)
+                sum += chunk->ceiling_priority[task % TASK_CHUNK_SIZE];
+            task = chunk->ref[task % TASK_CHUNK_SIZE];
+        }
+    }
+    result.walk_ns = NsSince(start, (long)rounds * count);
+
+    // Whole chunks at a time, the inner loop runs over two byte arrays
+    start = std::chrono::steady_clock::now();
+    for (round = 0; round < rounds; round++)
+    {
+        minimum = round % MAX_PRIORITY;
+
+        for (i = 0; i < count; i += TASK_CHUNK_SIZE)
+        {
+            chunk = chunks[i / TASK_CHUNK_SIZE];
+            size = (count - i < TASK_CHUNK_SIZE) ? count - i : TASK_CHUNK_SIZE;
+            ready = 0;
+
+            for (task = 0; task < size; task++)
+            {
+                ready += (chunk->state[task] == TASK_READY) & (chunk->ceiling_priority[task] >= minimum);
+            }
+
+            sum += ready;
+        }
+    }
+    result.scan_ns = NsSince(start, (long)rounds * count);
+
+    for (i = 0; i < (int)chunks.size(); i++)
+    {
+        free(chunks[i]);
+    }
+
+    result.checksum = sum;
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    static const int counts[] = {32, 256, 4096, 65536, 1 << 20};
+    TBenchResult aos, soa;
+    int i, rounds, count;
+
+    rounds = (argc > 1) ? atoi(argv[1]) : 0;
+
+    printf("hot bytes per task: aos %d (control block), soa %d\n",
+           (int)sizeof(TAosTask), (int)(sizeof(int32_t) + sizeof(int8_t) + sizeof(uint8_t)));
+    printf("%8s %12s %12s %12s %12s\n", "tasks", "aos_walk_ns", "soa_walk_ns", "aos_scan_ns", "soa_scan_ns");
+
+    for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++)
+    {
+        count = counts[i];
+
+        // About the same work for every size unless given
+        int size_rounds = (rounds > 0) ? rounds : (1 << 22) / count;
+        if (size_rounds < 4) size_rounds = 4;
+
+        aos = RunAos(count, size_rounds);
+        soa = RunSoa(count, size_rounds);
+
+        if (aos.checksum != soa.checksum)
+        {
+            printf("ERROR: Layouts disagree at %d tasks\n", count);
+            return 1;
+        }
+
+        printf("%8d %12.2f %12.2f %12.2f %12.2f\n", count, aos.walk_ns, soa.walk_ns,
+               aos.scan_ns, soa.scan_ns);
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*************************************/
+/*          trace_decode.cpp           */
+/*************************************/
+
+// Turns a trace file written by TraceDump() into readable text:
+//     traceDecode rtos_trace.bin
+
+#include <stdio.h>
+
+#include "trace.h"
+
+static const char* EventNames[TRACE_EV_COUNT] = {
+    "ActivateTask",
+    "Schedule",
+    "Dispatch",
+    "TerminateTask",
+    "GetResource",
+    "ReleaseResource",
+    "SetEvent",
+    "WaitEvent",
+    "DelayTask",
+    "Wakeup",
+    "Tick",
+    "ResourceBlock",
+    "Inherit",
+    "QueueSend",
+    "QueueReceive",
+    "QueueBlock",
+    "BufferSend",
+    "Alarm",
+    "DeadlineMiss"
+};
+
+int main(int argc, char* argv[])
+{
+    TTraceHeader header;
+    TTraceRecord record;
+    FILE* file;
+    uint32_t i;
+
+    if (argc != 2)
+    {
+        printf("Usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+
+    file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        printf("ERROR: Cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != TRACE_FILE_MAGIC ||
+        header.version != TRACE_FILE_VERSION ||
+        header.record_size != sizeof(TTraceRecord))
+    {
+        printf("ERROR: %s is not a trace file of this version\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    printf("%u records, %u dropped\n", header.count, header.dropped);
+
+    for (i = 0; i < header.count; i++)
+    {
+        if (fread(&record, sizeof(record), 1, file) != 1)
+        {
+            printf("ERROR: Trace truncated after %u records\n", i);
+            fclose(file);
+            return 1;
+        }
+
+        if (record.type < 0 || record.type >= TRACE_EV_COUNT)
+        {
+            printf("%8d  unknown event %d\n", record.tick, record.type);
+            continue;
+        }
+
+        switch (record.type)
+        {
+        case TRACE_EV_TICK:
+            printf("%8d  %s\n", record.tick, EventNames[record.type]);
+            break;
+        case TRACE_EV_TERMINATE:
+        case TRACE_EV_WAKEUP:
+            printf("%8d  %-16s task %d\n", record.tick, EventNames[record.type], record.task);
+            break;
+        default:
+            printf("%8d  %-16s task %d  arg %d\n", record.tick, EventNames[record.type],
+                   record.task, record.arg);
+            break;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}